@@ -0,0 +1,74 @@
+// Contention caused by atomic read-modify-writes whose operand is the
+// identity: atomic_fetch_add(&x, 0) still takes the cache line exclusive.
+//
+// Each thread adds `delta` to the bins of a shared histogram and to a shared
+// reference count. `delta` is zero for `zero_pct`% of the updates.
+//
+//   clang -O2 -fopenmp -emit-llvm -c atomic_bench.c -o bench.bc
+//   opt -load DAG/libDAG.so -DAG -dag-opt=ess bench.bc -o bench.phoenix.bc
+//   clang -O2 -fopenmp bench.bc -o bench
+//   clang -O2 -fopenmp bench.phoenix.bc -o bench.phoenix
+//
+//   OMP_NUM_THREADS=8 ./bench 100000000 90
+//   OMP_NUM_THREADS=8 ./bench.phoenix 100000000 90
+//
+// Output: threads,iterations,zero_pct,seconds
+
+#include <omp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BINS 16
+
+static _Atomic long histogram[BINS];
+static _Atomic long refcount;
+
+// xorshift, so that each thread has its own cheap generator
+static inline unsigned next(unsigned *state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+// Relaxed, as counters usually are: the DAG keeps release and seq_cst RMWs
+__attribute__((noinline)) static void update(unsigned bin, long delta) {
+  atomic_fetch_add_explicit(&histogram[bin], delta, memory_order_relaxed);
+  atomic_fetch_add_explicit(&refcount, delta, memory_order_relaxed);
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+  unsigned zero_pct = argc > 2 ? atoi(argv[2]) : 90;
+  int threads = 0;
+
+  double start = omp_get_wtime();
+
+#pragma omp parallel
+  {
+    unsigned state = 2463534242u + omp_get_thread_num();
+
+#pragma omp single
+    threads = omp_get_num_threads();
+
+#pragma omp for
+    for (long i = 0; i < iterations; i++) {
+      unsigned r = next(&state);
+      long delta = (r % 100) < zero_pct ? 0 : 1;
+      update(r % BINS, delta);
+    }
+  }
+
+  double seconds = omp_get_wtime() - start;
+
+  long total = 0;
+  for (unsigned i = 0; i < BINS; i++)
+    total += histogram[i];
+
+  // Keeps the updates alive and lets both binaries be checked
+  fprintf(stderr, "total: %ld refcount: %ld\n", total, (long)refcount);
+  printf("%d,%ld,%u,%f\n", threads, iterations, zero_pct, seconds);
+  return total != refcount;
+}
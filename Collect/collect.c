@@ -1,10 +1,22 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "collect.h"
 
+// Only needed by the flush thread, do not force programs to link with -pthread
+#pragma weak pthread_create
+#pragma weak pthread_detach
+
 // void record_load(long long id, void *address) {
 //   // printf("Record load with ID: %lld -> %p\n", id, address);
 //   records[id] = address;
@@ -69,284 +81,945 @@
 //   printf("%lld, %lld\n", store_after_load, num_dynamic_stores);
 // }
 
-// /////////////////////////
+/////////////////////////
 
-// char* TYPE(opcode){
-//   for (unsigned i = 0 ; i < LENGTH ; i++){
-//     if (data[i].opcode == opcode){
-//       return data[i].name;
-//     }
-//   }
-//   assert(0);
-// }
 
-// dynamic_execution* resize(dynamic_execution *dyn, int curr_size, int new_size) {
-//   dyn = (dynamic_execution *)realloc(dyn, sizeof(dynamic_execution) * new_size);
+// Single writer increment: only the owner thread writes to its shard, so a
+// relaxed load/store pair is enough (no `lock` prefix). The atomic accesses
+// just keep the concurrent reads made by `merge_records` well defined.
+#define INC(x) __atomic_store_n(&(x), __atomic_load_n(&(x), __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
 
-//   for (int i = curr_size; i < new_size; i++) {
-//     dyn[i].cnt_id = 0;
-//     dyn[i].cnt_wi = 0;
-//     dyn[i].a = 0;
-//     dyn[i].b = 0;
-//     dyn[i].both = 0;
-//   }
+// Returns the shard of the calling thread, registering it on the first call
+shard *get_shard(){
+  shard *s = local_shard;
+  if (s)
+    return s;
 
-//   return dyn;
-// }
+  s = (shard*) calloc(1, sizeof(shard));
+  assertf(s != NULL, "could not allocate a shard");
 
-// void record_id_individually(arithmetic_inst *ai, long long static_id, int has) {
-//   // realloc if needed
-//   if (ai->size <= static_id) {
-//     ai->dyn = resize(ai->dyn, ai->size, static_id + 1);
-//     // set the correct size
-//     ai->size = static_id + 1;
-//   }
+  // lock-free push on the list of shards
+  s->next = __atomic_load_n(&shards, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&shards, &s->next, s, 1, __ATOMIC_RELEASE,
+                                      __ATOMIC_RELAXED))
+    ;
 
-//   if (has == BOTH){
-//     ai->dyn[static_id].cnt_id++;
-//     ai->dyn[static_id].both++;
-//   }
-//   else if (has == ID_A){
-//     ai->dyn[static_id].cnt_id++;
-//     ai->dyn[static_id].a++;
-//   }
-//   else if (has == ID_B){
-//     ai->dyn[static_id].cnt_id++;
-//     ai->dyn[static_id].b++;
-//   }
-//   else{
-//     ai->dyn[static_id].cnt_wi++;
-//   }
+  if (num_static_stores > 0)
+    grow_store_block(s, num_static_stores);
+  if (num_static_arith > 0)
+    grow_arith_block(s, num_static_arith);
+  if (num_static_values > 0)
+    grow_value_block(s, num_static_values);
 
-// }
+  local_shard = s;
+  return s;
+}
 
-// // Returns 0 if neither a or b are the identity
-// // 1 if a is the identity
-// // 2 if b is the identity
-// // 3 if both a and b are the identity;
-// //
-// // @opcode is self-explanatory
-// // @a and @b are the actual values involved in the arithmetic instruction
-// // @op_pos tells whether @a or @b is the destiny operand. For instance, since
-// // we only keep track of instructions of the form `*p += v`, *p is either @a or @b
-// //  *p = *p + v = a + b
-// //     = *p + b
-// //     = a + *p
-// // We only consider that there is an identity iff the operand holding the identity
-// // value is not the one indicated by op_pos. 
-// //
-// // This function returns which operand holds the identity
-// //
-// int has_identity(unsigned opcode, void* a, void* b, unsigned op_pos) {
-//   switch (opcode) {
-//   case 13: // Sub
-//     if (op_pos == FIRST && LL(b) == 0) // *p = *p - 0
-//       return ID_B;
-//     return NONE;
-//   case 11: // Add
-//   case 28: // Xor
-//     if (op_pos == SECOND && LL(a) == 0) // *p = 0 + *p (...)
-//       return ID_A;
-//     else if (LL(b) == 0) // *p = *p + 0 (...)
-//       return ID_B;
-//     else
-//       return NONE;
-
-//   case 15: // Mul
-//   case 17: // UDiv
-//   case 18: // SDiv
-//     if (op_pos == SECOND && LL(a) == 1) // *p = 1 x *p
-//       return ID_A;
-//     else if (op_pos == FIRST && LL(b) == 1) // *p = *p x 1
-//       return ID_B;
-//     else
-//       return NONE;
-
-//   case 26: // And
-//   case 27: // Or
-//     return (LL(a) == LL(b)) ? BOTH : NONE;
-
-//   case 12: //Fadd
-//     if (op_pos == SECOND && DB(a) == 0.0) // *p = 0.0 + *p
-//       return ID_A;
-//     else if (op_pos == FIRST && DB(b) == 0.0) // *p = *p + 0.0
-//       return ID_B;
-//     return NONE;
-
-//   case 14: // FSub
-//     if (op_pos == FIRST && DB(b) == 0.0) // *p = *p - 0.0
-//       return ID_B;
-//     return NONE;
-
-//   case 16: // FMul
-//     if (op_pos == SECOND && DB(a) == 1.0) // *p = 1.0 x *p
-//       return ID_A;
-//     else if (op_pos == FIRST && DB(b) == 1.0) // *p = *p x 1.0
-//       return ID_B;
-//     else
-//       return NONE;
-
-//   case 19: // FDiv
-//     if (op_pos == FIRST && DB(b) == 1.0) // *p = *p / 1.0
-//       return ID_B;
-//     else
-//       return NONE;
-
-//   case 23: // Shl
-//   case 24: // LShr
-//   case 25: // AShr
-//     if (op_pos == FIRST && LL(a) == 0) // *p = *p << 0
-//       return ID_B;
-//     return NONE;
-
-//   default:
-//     assertf(0, "Opcode: %s", TYPE(opcode));
-//   }
-// }
+store_block *grow_store_block(shard *s, unsigned new_size){
+  store_block *old = s->stores;
+  unsigned old_size = old ? old->size : 0;
+
+  store_block *b = (store_block*) malloc(sizeof(store_block) + sizeof(store_counter) * new_size);
+  assertf(b != NULL, "could not grow the shard to %u stores", new_size);
+
+  b->size = new_size;
+  for (unsigned i = 0; i < new_size; i++) {
+    if (i < old_size) {
+      b->c[i].silent = __atomic_load_n(&old->c[i].silent, __ATOMIC_RELAXED);
+      b->c[i].total = __atomic_load_n(&old->c[i].total, __ATOMIC_RELAXED);
+      b->c[i].is_marked = __atomic_load_n(&old->c[i].is_marked, __ATOMIC_RELAXED);
+    } else {
+      b->c[i].silent = 0;
+      b->c[i].total = 0;
+      b->c[i].is_marked = 0;
+    }
+  }
 
-// unsigned get_index(unsigned opcode){
-//   unsigned index = -1;
-  
-//   for (unsigned i = 0; i < LENGTH; i++)
-//     if (data[i].opcode == opcode) {
-//       index = i;
-//       break;
-//     }
+  // publish the new block. @old is leaked on purpose (see collect.h)
+  __atomic_store_n(&s->stores, b, __ATOMIC_RELEASE);
+  return b;
+}
 
-//   assertf(index >= 0 && index <= LENGTH, "opcode = %s - index = %d", TYPE(opcode), index);
+void init_records(unsigned total_static_stores){
+  // Several modules may be linked together, keep the biggest one
+  if (total_static_stores > num_static_stores)
+    num_static_stores = total_static_stores;
+}
 
-//   return index;
-// }
+void realloc_records(unsigned new_size){
+  // fprintf(stderr, "realocou com size: %u\n", new_size);
+  r = (record*) realloc(r, sizeof(record) * new_size); 
+  for (int i=__size; i<new_size; i++){
+    r[i].store_id = i;
+    r[i].is_marked = 0;
+    r[i].silent = 0;
+    r[i].total = 0;
+  }
 
-// // Given an arithmeic instruction of the type:
-// //   c = c `op` b   or c = a `op` c
-// // record if the variables `a` or `b` are the identity value
-// // for the arithmetic instruction given by `op`.
-// // 
-// // The question remaining is now to detect which operand is `c` (a or b)
-// // To that end, we also record the address of `c` as well as the address of
-// // the operand that is supposed to be `c`. This operand was detected by a static
-// // analysis and may not be precise. We are sending it to check it with an assert!
-// // 
-// // So, `dest_address` and `op_address` are those values described below. The unsigned
-// // value `op_pos` tells us which operand our static analysis detected as being `c`.
-// // This value is either 1 (FIRST) or 2 (SECOND)
-// //
-// void record_arith(unsigned opcode, long long static_id, void* a,
-//                   void* b, void *dest_address, void *op_address, unsigned op_pos) {
-
-//   assert(op_pos == FIRST || op_pos == SECOND);
-//   assertf(dest_address == op_address, "[%s(%lld)]: %p - %p", TYPE(opcode), static_id, dest_address, op_address);
-
-//   unsigned index = get_index(opcode);
-
-//   data[index].total_exec++;
-
-//   int has = has_identity(opcode, a, b, op_pos);
-//   if (has)
-//     data[index].identity_exec++;
-
-//   record_id_individually(&data[index], static_id, has);
-
-//   /* printf("opcode: %d with value: %lld\n", opcode, value); */
-// }
+  __size = new_size;
+  // fprintf(stderr, "novo size: %u\n", __size);
+}
 
-// void record_arith_int(unsigned opcode, long long static_id, long long a,
-//                       long long b, void *dest_address, void *op_address,
-//                       unsigned op_pos) {
-//   record_arith(opcode, static_id, (void*)&a, (void*)&b, dest_address, op_address, op_pos);
-// }
+// Sum the counters of every shard into `r`
+void merge_records(){
+  if (__size < num_static_stores)
+    realloc_records(num_static_stores);
 
-// void record_arith_float(unsigned opcode, long long static_id, double a,
-//                         double b, void *dest_address, void *op_address, unsigned op_pos) {
-//   record_arith(opcode, static_id, (void*)&a, (void*)&b, dest_address, op_address, op_pos);
-// }
+  for (int i = 0; i < __size; i++) {
+    r[i].is_marked = 0;
+    r[i].silent = 0;
+    r[i].total = 0;
+  }
 
-// char* get_filename(char *name){
-//   char *fname = (char*) malloc(sizeof(char) * (5 + strnlen(name, 4)));
-//   sprintf(fname, "%s.txt", name);
-//   return fname;
-// }
+  for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+    store_block *b = __atomic_load_n(&s->stores, __ATOMIC_ACQUIRE);
+    if (b == NULL)
+      continue;
 
-// void dump_by_type(arithmetic_inst *ai) {
-//   FILE *f = fopen(get_filename(ai->name), "w");
+    if (b->size > __size)
+      realloc_records(b->size);
 
-//   long long total = 0;
+    for (unsigned i = 0; i < b->size; i++) {
+      r[i].is_marked |= __atomic_load_n(&b->c[i].is_marked, __ATOMIC_RELAXED);
+      r[i].silent += __atomic_load_n(&b->c[i].silent, __ATOMIC_RELAXED);
+      r[i].total += __atomic_load_n(&b->c[i].total, __ATOMIC_RELAXED);
+    }
+  }
 
-//   for (int i = 0; i < ai->size; i++) {
-//     dynamic_execution de = ai->dyn[i];
-//     total += de.cnt_id + de.cnt_wi;
-//     if (de.cnt_id >= de.cnt_wi){
-//       fprintf(f, "*static_id[%d] = %lld(%lld, %lld, %lld), %lld\n", i, de.cnt_id, de.a,
-//               de.b, de.both, de.cnt_wi);
-//     }
-//     else {
-//       fprintf(f, "static_id[%d] = %lld(%lld, %lld), %lld\n", i, de.cnt_id, de.a,
-//               de.b, de.cnt_wi);
-//     }
-//   }
+  // Drop the slack left by `record_store_slow` growing the blocks
+  unsigned used = num_static_stores;
+  for (unsigned i = used; i < __size; i++)
+    if (r[i].total > 0)
+      used = i + 1;
+  __size = used;
+}
 
-//   assert(total == ai->total_exec);
+// First store of a thread or a store_id bigger than what `init_records`
+// announced (i.e. the module was not compiled with a constructor).
+// Grow geometrically to avoid copying the block over and over again
+store_block *record_store_slow(unsigned store_id){
+  shard *s = get_shard();
+  store_block *b = s->stores;
 
-//   fclose(f);
-// }
+  if (b != NULL && store_id < b->size)
+    return b;
 
-// void dump_arith() {
-//   FILE *f = fopen("arith.txt", "w");
+  unsigned new_size = b ? b->size * 2 : 16;
+  new_size = max(new_size, max(store_id + 1, num_static_stores));
+  return grow_store_block(s, new_size);
+}
 
-//   fprintf(f, "Instruction,static_instances,dyn_eq,dyn_total\n");
-//   for (int i = 0; i < LENGTH; i++) {
-//     dump_by_type(&data[i]);
-//     fprintf(f, "%s,%d,%llu,%llu\n", data[i].name, data[i].size, data[i].identity_exec,
-//             data[i].total_exec);
-//   }
-//   fprintf(f, "\n");
+void record_store(unsigned store_id, unsigned is_marked, int is_equals){
+  shard *s = local_shard;
+  store_block *b = s ? s->stores : NULL;
 
-//   fclose(f);
-// }
+  // Fast path: the block was already sized by `init_records`
+  if (__builtin_expect(b == NULL || store_id >= b->size, 0))
+    b = record_store_slow(store_id);
 
+  store_counter *c = &b->c[store_id];
+  __atomic_store_n(&c->is_marked, is_marked, __ATOMIC_RELAXED);
+  if (is_equals)
+    INC(c->silent);
+  INC(c->total);
+}
 
+void init_arith(unsigned num_sites){
+  // Several modules may be linked together, keep the biggest one
+  if (num_sites > num_static_arith)
+    num_static_arith = num_sites;
+}
 
-/////////////////////////
+arith_block *grow_arith_block(shard *s, unsigned new_size){
+  arith_block *old = s->arith;
+  unsigned old_size = old ? old->size : 0;
+
+  arith_block *b = (arith_block*) malloc(sizeof(arith_block) + sizeof(arith_counter) * new_size);
+  assertf(b != NULL, "could not grow the shard to %u instructions", new_size);
+
+  b->size = new_size;
+  for (unsigned i = 0; i < new_size; i++) {
+    if (i < old_size) {
+      b->c[i].opcode = __atomic_load_n(&old->c[i].opcode, __ATOMIC_RELAXED);
+      b->c[i].identity = __atomic_load_n(&old->c[i].identity, __ATOMIC_RELAXED);
+      b->c[i].total = __atomic_load_n(&old->c[i].total, __ATOMIC_RELAXED);
+    } else {
+      b->c[i].opcode = 0;
+      b->c[i].identity = 0;
+      b->c[i].total = 0;
+    }
+  }
 
+  // publish the new block. @old is leaked, as in grow_store_block
+  __atomic_store_n(&s->arith, b, __ATOMIC_RELEASE);
+  return b;
+}
 
-void realloc_records(unsigned new_size){
-  // fprintf(stderr, "realocou com size: %u\n", new_size);
-  r = (record*) realloc(r, sizeof(record) * new_size); 
-  for (int i=__size; i<new_size; i++){
-    r[i].store_id = i;
-    r[i].is_marked = 0;
-    r[i].silent = 0;
-    r[i].total = 0;
+// First instruction of a thread or an id bigger than what `init_arith`
+// announced, see record_store_slow
+static arith_block *record_arith_slow(unsigned id){
+  shard *s = get_shard();
+  arith_block *b = s->arith;
+
+  if (b != NULL && id < b->size)
+    return b;
+
+  unsigned new_size = b ? b->size * 2 : 16;
+  new_size = max(new_size, max(id + 1, num_static_arith));
+  return grow_arith_block(s, new_size);
+}
+
+static inline void record_arith(unsigned id, unsigned opcode, int is_identity){
+  shard *s = local_shard;
+  arith_block *b = s ? s->arith : NULL;
+
+  if (__builtin_expect(b == NULL || id >= b->size, 0))
+    b = record_arith_slow(id);
+
+  arith_counter *c = &b->c[id];
+  __atomic_store_n(&c->opcode, opcode, __ATOMIC_RELAXED);
+  if (is_identity)
+    INC(c->identity);
+  INC(c->total);
+}
+
+#define PHOENIX_DEFINE_ARITH(TY, T, OP, OPCODE, IDENTITY)                  \
+  void record_arith_##TY##_##OP(unsigned id, T a, T b, unsigned op_pos) { \
+    record_arith(id, OPCODE, IDENTITY);                                    \
   }
 
-  __size = new_size;
-  // fprintf(stderr, "novo size: %u\n", __size);
+PHOENIX_ARITH(PHOENIX_DEFINE_ARITH)
+
+void init_values(unsigned num_sites){
+  if (num_sites > num_static_values)
+    num_static_values = num_sites;
 }
 
-void record_store(unsigned store_id, unsigned is_marked, int is_equals){
-  if (store_id >= __size)
-    realloc_records(store_id+1);
+value_block *grow_value_block(shard *s, unsigned new_size){
+  value_block *old = s->values;
+  unsigned old_size = old ? old->size : 0;
 
-  r[store_id].is_marked = is_marked;
-  if (is_equals)
-    r[store_id].silent++;
-  r[store_id].total++;
+  value_block *b = (value_block*) calloc(1, sizeof(value_block) + sizeof(value_site) * new_size);
+  assertf(b != NULL, "could not grow the shard to %u value sites", new_size);
+
+  b->size = new_size;
+  for (unsigned i = 0; i < old_size; i++) {
+    for (unsigned j = 0; j < 1 + 2 * PHOENIX_VALUE_SLOTS; j++)
+      b->c[i].c[j] = __atomic_load_n(&old->c[i].c[j], __ATOMIC_RELAXED);
+    b->c[i].is_fp = __atomic_load_n(&old->c[i].is_fp, __ATOMIC_RELAXED);
+  }
+
+  // publish the new block. @old is leaked, as in grow_store_block
+  __atomic_store_n(&s->values, b, __ATOMIC_RELEASE);
+  return b;
 }
 
-void dump_records(){
-  FILE *f = fopen("store.txt", "w");
-  fprintf(f, "id,marked,silent,total\n");
-  for (int i = 0; i < __size; i++) {
-    fprintf(f, "%d,%d,%llu,%llu\n", r[i].store_id, r[i].is_marked, r[i].silent, r[i].total);
+static value_block *record_value_slow(unsigned id){
+  shard *s = get_shard();
+  value_block *b = s->values;
+
+  if (b != NULL && id < b->size)
+    return b;
+
+  unsigned new_size = b ? b->size * 2 : 16;
+  new_size = max(new_size, max(id + 1, num_static_values));
+  return grow_value_block(s, new_size);
+}
+
+// Only the owner thread writes to the sketch, the relaxed stores keep the
+// reads of a concurrent dump well defined
+#define SET(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+void record_value(unsigned id, unsigned long long value, unsigned is_fp){
+  shard *sh = local_shard;
+  value_block *b = sh ? sh->values : NULL;
+
+  if (__builtin_expect(b == NULL || id >= b->size, 0))
+    b = record_value_slow(id);
+
+  value_site *s = &b->c[id];
+  unsigned long long *slots = &s->c[1], *min = NULL;
+
+  SET(s->is_fp, is_fp);
+  INC(s->c[0]);
+
+  // Slots are filled in order, an empty one means @value is not there
+  for (unsigned i = 0; i < PHOENIX_VALUE_SLOTS; i++) {
+    unsigned long long *slot = &slots[2 * i];
+    if (slot[1] == 0) {
+      SET(slot[0], value);
+      SET(slot[1], 1);
+      return;
+    }
+    if (slot[0] == value) {
+      INC(slot[1]);
+      return;
+    }
+    if (min == NULL || slot[1] < min[1])
+      min = slot;
+  }
+
+  SET(min[0], value);
+  INC(min[1]);
+}
+
+// True if some thread recorded a counter of @kind through the runtime
+int has_shard_data(unsigned kind){
+  for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+    if (kind == PHOENIX_STORE_COUNTERS && __atomic_load_n(&s->stores, __ATOMIC_ACQUIRE))
+      return 1;
+    if (kind == PHOENIX_ARITH_COUNTERS && __atomic_load_n(&s->arith, __ATOMIC_ACQUIRE))
+      return 1;
+    if (kind == PHOENIX_VALUE_COUNTERS && __atomic_load_n(&s->values, __ATOMIC_ACQUIRE))
+      return 1;
+  }
+  return 0;
+}
+
+int has_module_data(unsigned kind){
+  FOR_EACH_MODULE_DATA(d, kind)
+    return 1;
+  return 0;
+}
+
+void set_sample_rate(unsigned rate){
+  // All modules should be compiled with the same rate, keep the last one
+  if (rate > 0)
+    sample_rate = rate;
+}
+
+// Prints "hits,total" scaled by @rate. When @sampled, also prints the bounds
+// of the 95% confidence interval of hits: "hits,total,hits_lo,hits_hi"
+int use_online_merge(){
+  const char *merge = getenv("PHOENIX_PROFILE_MERGE");
+  return merge != NULL && strcmp(merge, "") != 0 && strcmp(merge, "0") != 0;
+}
+
+int use_binary_profile(){
+  const char *format = getenv("PHOENIX_PROFILE_FORMAT");
+  // Only binary profiles can be merged
+  return (format != NULL && strcmp(format, "binary") == 0) || use_online_merge();
+}
+
+const char *kind_name(unsigned kind){
+  switch (kind) {
+    case PHOENIX_STORE_COUNTERS:
+      return "store";
+    case PHOENIX_ARITH_COUNTERS:
+      return "arith";
+    default:
+      return "values";
+  }
+}
+
+// True if PHOENIX_PROFILE_FILE asks for one file per module
+int profile_per_module(){
+  const char *pattern = getenv("PHOENIX_PROFILE_FILE");
+  for (const char *c = pattern; c != NULL && *c != '\0'; c++) {
+    if (c[0] == '%' && c[1] == 'm')
+      return 1;
+    if (c[0] == '%' && c[1] != '\0')
+      c++;
+  }
+  return 0;
+}
+
+// Expands PHOENIX_PROFILE_FILE:
+//   %p -> pid, %h -> hostname, %m -> module hash, %k -> store/arith, %% -> %
+// Without it, the profile goes to store.txt/arith.txt (or .profraw)
+void get_profile_filename(char *buf, size_t size, unsigned kind, unsigned long long module_hash){
+  const char *pattern = getenv("PHOENIX_PROFILE_FILE");
+  if (pattern == NULL || *pattern == '\0') {
+    snprintf(buf, size, "%s.%s", kind_name(kind), use_binary_profile() ? "profraw" : "txt");
+    return;
+  }
+
+  size_t n = 0;
+  for (const char *c = pattern; *c != '\0' && n + 1 < size; c++) {
+    if (c[0] != '%' || c[1] == '\0') {
+      buf[n++] = *c;
+      continue;
+    }
+
+    char tmp[256];
+    switch (*++c) {
+      case 'p':
+        snprintf(tmp, sizeof(tmp), "%d", (int)getpid());
+        break;
+      case 'h':
+        if (gethostname(tmp, sizeof(tmp)) != 0)
+          strcpy(tmp, "localhost");
+        tmp[sizeof(tmp) - 1] = '\0';
+        break;
+      case 'm':
+        snprintf(tmp, sizeof(tmp), "%llx", module_hash);
+        break;
+      case 'k':
+        snprintf(tmp, sizeof(tmp), "%s", kind_name(kind));
+        break;
+      case '%':
+        strcpy(tmp, "%");
+        break;
+      default:
+        snprintf(tmp, sizeof(tmp), "%%%c", *c);
+    }
+
+    n += snprintf(buf + n, size - n, "%s", tmp);
+    if (n >= size)
+      n = size - 1;
+  }
+  buf[n] = '\0';
+}
+
+static void init_prof_entry(prof_entry *e, unsigned long long module_hash, unsigned kind,
+                            unsigned num_sites, unsigned rate){
+  unsigned cps = phoenix_prof_counters_per_site(kind);
+  e->m = (phoenix_prof_module){module_hash, kind, num_sites, rate, 0, 0, cps, 0};
+  e->info = (unsigned char*) calloc(num_sites + 1, sizeof(unsigned char));
+  e->counters = (unsigned long long*) calloc(cps * num_sites + 1, sizeof(unsigned long long));
+  assertf(e->info != NULL && e->counters != NULL, "could not allocate the profile");
+}
+
+prof_entry *add_prof_entry(prof_list *l, unsigned long long module_hash, unsigned kind,
+                           unsigned num_sites, unsigned rate){
+  l->e = (prof_entry*) realloc(l->e, sizeof(prof_entry) * (l->size + 1));
+  assertf(l->e != NULL, "could not allocate the profile");
+
+  prof_entry *e = &l->e[l->size++];
+  init_prof_entry(e, module_hash, kind, num_sites, rate);
+  return e;
+}
+
+prof_entry *find_prof_entry(prof_list *l, unsigned long long module_hash, unsigned kind){
+  for (unsigned i = 0; i < l->size; i++)
+    if (l->e[i].m.module_hash == module_hash && l->e[i].m.kind == kind)
+      return &l->e[i];
+  return NULL;
+}
+
+void free_profile(prof_list *l){
+  for (unsigned i = 0; i < l->size; i++) {
+    free(l->e[i].info);
+    free(l->e[i].counters);
+  }
+  free(l->e);
+  l->e = NULL;
+  l->size = 0;
+}
+
+// Copies every counter of @kind into @l. Stores recorded through
+// `record_store` are put in module 0
+void collect_profile(unsigned kind, prof_list *l){
+  if (kind == PHOENIX_STORE_COUNTERS && __size > 0) {
+    prof_entry *e = add_prof_entry(l, 0, kind, __size, sample_rate);
+    for (int i = 0; i < __size; i++) {
+      e->info[i] = r[i].is_marked;
+      e->counters[2 * i] = r[i].silent;
+      e->counters[2 * i + 1] = r[i].total;
+    }
+  }
+
+  // Instructions recorded through `record_arith_*`, summed over the shards,
+  // also in module 0. Drop the slack left by `record_arith_slow`
+  unsigned num_arith = kind == PHOENIX_ARITH_COUNTERS ? num_static_arith : 0;
+  for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+       kind == PHOENIX_ARITH_COUNTERS && s != NULL; s = s->next) {
+    arith_block *b = __atomic_load_n(&s->arith, __ATOMIC_ACQUIRE);
+    for (unsigned i = num_arith; b != NULL && i < b->size; i++)
+      if (__atomic_load_n(&b->c[i].total, __ATOMIC_RELAXED) > 0)
+        num_arith = i + 1;
+  }
+
+  if (num_arith > 0) {
+    prof_entry *e = add_prof_entry(l, 0, kind, num_arith, sample_rate);
+    for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+      arith_block *b = __atomic_load_n(&s->arith, __ATOMIC_ACQUIRE);
+      for (unsigned i = 0; b != NULL && i < b->size && i < num_arith; i++) {
+        unsigned opcode = __atomic_load_n(&b->c[i].opcode, __ATOMIC_RELAXED);
+        if (opcode != 0)
+          e->info[i] = opcode;
+        e->counters[2 * i] += __atomic_load_n(&b->c[i].identity, __ATOMIC_RELAXED);
+        e->counters[2 * i + 1] += __atomic_load_n(&b->c[i].total, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  unsigned num_values = kind == PHOENIX_VALUE_COUNTERS ? num_static_values : 0;
+  for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+       kind == PHOENIX_VALUE_COUNTERS && s != NULL; s = s->next) {
+    value_block *b = __atomic_load_n(&s->values, __ATOMIC_ACQUIRE);
+    for (unsigned i = num_values; b != NULL && i < b->size; i++)
+      if (__atomic_load_n(&b->c[i].c[0], __ATOMIC_RELAXED) > 0)
+        num_values = i + 1;
+  }
+
+  if (num_values > 0) {
+    prof_entry *e = add_prof_entry(l, 0, kind, num_values, sample_rate);
+    for (shard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s != NULL; s = s->next) {
+      value_block *b = __atomic_load_n(&s->values, __ATOMIC_ACQUIRE);
+      for (unsigned i = 0; b != NULL && i < b->size && i < num_values; i++) {
+        uint64_t c[1 + 2 * PHOENIX_VALUE_SLOTS];
+        for (unsigned j = 0; j < 1 + 2 * PHOENIX_VALUE_SLOTS; j++)
+          c[j] = __atomic_load_n(&b->c[i].c[j], __ATOMIC_RELAXED);
+
+        e->info[i] |= __atomic_load_n(&b->c[i].is_fp, __ATOMIC_RELAXED);
+        // merging into the entry sorts the values, most frequent first
+        phoenix_prof_merge_values((uint64_t*) &e->counters[i * e->m.counters_per_site], c);
+      }
+    }
+  }
+
+  FOR_EACH_MODULE_DATA(d, kind) {
+    prof_entry *e = add_prof_entry(l, d->module_hash, kind, d->num_sites, d->sample_rate);
+    memcpy(e->info, d->info, d->num_sites);
+    memcpy(e->counters, d->counters, 2 * sizeof(unsigned long long) * d->num_sites);
+  }
+}
+
+// Adds the counters of @src to the ones of the same module in @l
+void merge_prof_entry(prof_list *l, const prof_entry *src){
+  const phoenix_prof_module *m = &src->m;
+  prof_entry *dst = find_prof_entry(l, m->module_hash, m->kind);
+
+  if (dst != NULL && (dst->m.num_sites != m->num_sites || dst->m.sample_rate != m->sample_rate)) {
+    // The module was recompiled since the profile was written, start over
+    fprintf(stderr, "phoenix: module %llx does not match the profile, overwriting it\n",
+            (unsigned long long)m->module_hash);
+    free(dst->info);
+    free(dst->counters);
+    init_prof_entry(dst, m->module_hash, m->kind, m->num_sites, m->sample_rate);
+  }
+
+  if (dst == NULL)
+    dst = add_prof_entry(l, m->module_hash, m->kind, m->num_sites, m->sample_rate);
+
+  for (unsigned i = 0; i < m->num_sites; i++)
+    dst->info[i] |= src->info[i];
+
+  if (m->kind == PHOENIX_VALUE_COUNTERS) {
+    for (unsigned i = 0; i < m->num_sites; i++)
+      phoenix_prof_merge_values((uint64_t*) &dst->counters[i * m->counters_per_site],
+                                (const uint64_t*) &src->counters[i * m->counters_per_site]);
+    return;
+  }
+
+  for (unsigned i = 0; i < m->counters_per_site * m->num_sites; i++)
+    dst->counters[i] += src->counters[i];
+}
+
+// Encodes @l using the format described in profile_format.h
+uint8_t *encode_profile(prof_list *l, size_t *size){
+  size_t index_size = sizeof(phoenix_prof_header) + l->size * sizeof(phoenix_prof_module);
+  size_t bound = index_size;
+  for (unsigned i = 0; i < l->size; i++)
+    bound += l->e[i].m.num_sites * (1 + l->e[i].m.counters_per_site * PHOENIX_PROF_MAX_VARINT);
+
+  uint8_t *buf = (uint8_t*) calloc(1, bound);
+  assertf(buf != NULL, "could not allocate the profile (%zu bytes)", bound);
+
+  phoenix_prof_init_header((phoenix_prof_header*) buf, l->size);
+  phoenix_prof_module *index = (phoenix_prof_module*) (buf + sizeof(phoenix_prof_header));
+  size_t pos = index_size;
+
+  for (unsigned i = 0; i < l->size; i++) {
+    prof_entry *e = &l->e[i];
+
+    index[i] = e->m;
+    index[i].offset = pos;
+
+    memcpy(buf + pos, e->info, e->m.num_sites);
+    pos += e->m.num_sites;
+    for (unsigned j = 0; j < e->m.counters_per_site * e->m.num_sites; j++)
+      pos += phoenix_prof_encode(e->counters[j], buf + pos);
+
+    index[i].size = pos - index[i].offset;
+  }
+
+  *size = pos;
+  return buf;
+}
+
+// Appends the modules of the profile in @buf to @l. Returns 0 if @buf is
+// not a valid profile
+int decode_profile(const uint8_t *buf, size_t size, prof_list *l){
+  phoenix_prof_header h;
+  if (size < sizeof(h))
+    return 0;
+  memcpy(&h, buf, sizeof(h));
+  if (!phoenix_prof_check_header(&h))
+    return 0;
+  if (size < sizeof(h) + h.num_modules * sizeof(phoenix_prof_module))
+    return 0;
+
+  for (unsigned i = 0; i < h.num_modules; i++) {
+    phoenix_prof_module m;
+    memcpy(&m, buf + sizeof(h) + i * sizeof(m), sizeof(m));
+    if (m.offset + m.size > size || m.size < m.num_sites ||
+        m.counters_per_site != phoenix_prof_counters_per_site(m.kind))
+      return 0;
+
+    const uint8_t *p = buf + m.offset, *end = p + m.size;
+    prof_entry *e = add_prof_entry(l, m.module_hash, m.kind, m.num_sites, m.sample_rate);
+    memcpy(e->info, p, m.num_sites);
+    p += m.num_sites;
+
+    for (unsigned j = 0; j < m.counters_per_site * m.num_sites; j++) {
+      uint64_t value;
+      if (!phoenix_prof_decode(&p, end, &value))
+        return 0;
+      e->counters[j] = value;
+    }
+  }
+  return 1;
+}
+
+static void write_all(int fd, const uint8_t *buf, size_t size, const char *filename){
+  for (size_t done = 0; done < size;) {
+    ssize_t n = write(fd, buf + done, size - done);
+    assertf(n > 0, "could not write %s", filename);
+    done += n;
+  }
+}
+
+// Writes @l to @filename with a single `write`. With PHOENIX_PROFILE_MERGE,
+// the file is locked and the counters already in it are added to @l, so
+// that concurrent processes can share a profile
+void write_binary_profile(const char *filename, prof_list *l){
+  if (!use_online_merge()) {
+    size_t size;
+    uint8_t *buf = encode_profile(l, &size);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assertf(fd >= 0, "could not open %s", filename);
+    write_all(fd, buf, size, filename);
+    close(fd);
+    free(buf);
+    return;
+  }
+
+  int fd = open(filename, O_RDWR | O_CREAT, 0644);
+  assertf(fd >= 0, "could not open %s", filename);
+  assertf(flock(fd, LOCK_EX) == 0, "could not lock %s", filename);
+
+  struct stat st;
+  assertf(fstat(fd, &st) == 0, "could not stat %s", filename);
+
+  prof_list merged = {0, NULL};
+  if (st.st_size > 0) {
+    uint8_t *old = (uint8_t*) malloc(st.st_size);
+    assertf(old != NULL, "could not allocate the profile");
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+      ssize_t n = pread(fd, old + done, st.st_size - done, done);
+      if (n <= 0)
+        break;
+      done += n;
+    }
+
+    if (!decode_profile(old, done, &merged)) {
+      fprintf(stderr, "phoenix: %s is not a valid profile, overwriting it\n", filename);
+      free_profile(&merged);
+    }
+    free(old);
+  }
+
+  for (unsigned i = 0; i < l->size; i++)
+    merge_prof_entry(&merged, &l->e[i]);
+
+  size_t size;
+  uint8_t *buf = encode_profile(&merged, &size);
+
+  assertf(ftruncate(fd, 0) == 0, "could not truncate %s", filename);
+  assertf(lseek(fd, 0, SEEK_SET) == 0, "could not seek %s", filename);
+  write_all(fd, buf, size, filename);
+
+  flock(fd, LOCK_UN);
+  close(fd);
+  free(buf);
+  free_profile(&merged);
+}
+
+// One row per value: "module,id,total,value,count", most frequent first.
+// Counts are scaled by the sample rate like the other counters
+static void write_text_values(FILE *f, prof_list *l){
+  fprintf(f, "module,id,total,value,count\n");
+  for (unsigned i = 0; i < l->size; i++) {
+    prof_entry *e = &l->e[i];
+    for (unsigned j = 0; j < e->m.num_sites; j++)
+      phoenix_prof_print_values(f, e->m.module_hash, j, e->info[j],
+                                (const uint64_t*) &e->counters[j * e->m.counters_per_site],
+                                e->m.sample_rate);
+  }
+  fprintf(f, "\n");
+}
+
+// One row per opcode of arith_rows: the number of instructions and their
+// executions, scaled by the sample rate of each module. When sampling, the
+// bounds of the intervals of the modules are added up
+static void write_text_arith(FILE *f, prof_list *l, int sampled){
+  fprintf(f, "Instruction,static_instances,dyn_eq,dyn_total%s\n",
+          sampled ? ",dyn_eq_lo,dyn_eq_hi" : "");
+
+  for (unsigned row = 0; row < PHOENIX_ARITH_ROWS; row++) {
+    unsigned instances = 0;
+    unsigned long long eq = 0, total = 0, lo = 0, hi = 0;
+
+    for (unsigned i = 0; i < l->size; i++) {
+      prof_entry *e = &l->e[i];
+      unsigned rate = e->m.sample_rate ? e->m.sample_rate : 1;
+
+      for (unsigned j = 0; j < e->m.num_sites; j++) {
+        if (e->info[j] != arith_rows[row].opcode)
+          continue;
+
+        uint64_t site_lo = e->counters[2 * j] * rate, site_hi = site_lo;
+        if (sampled)
+          phoenix_prof_interval(e->counters[2 * j], e->counters[2 * j + 1], rate, &site_lo,
+                                &site_hi);
+
+        instances++;
+        eq += e->counters[2 * j] * rate;
+        total += e->counters[2 * j + 1] * rate;
+        lo += site_lo;
+        hi += site_hi;
+      }
+    }
+
+    fprintf(f, "%s,%u,%llu,%llu", arith_rows[row].name, instances, eq, total);
+    if (sampled)
+      fprintf(f, ",%llu,%llu", lo, hi);
+    fprintf(f, "\n");
+  }
+  fprintf(f, "\n");
+}
+
+// Same format as before the binary profiles existed: stores only get a
+// `module` column when some module used inline counters
+void write_text_profile(const char *filename, unsigned kind, prof_list *l){
+  int sampled = 0, only_records = 1;
+  for (unsigned i = 0; i < l->size; i++) {
+    sampled |= l->e[i].m.sample_rate > 1;
+    only_records &= l->e[i].m.module_hash == 0;
+  }
+
+  FILE *f = fopen(filename, "w");
+  assertf(f != NULL, "could not open %s", filename);
+
+  if (kind == PHOENIX_VALUE_COUNTERS) {
+    write_text_values(f, l);
+    fclose(f);
+    return;
+  }
+
+  if (kind == PHOENIX_ARITH_COUNTERS) {
+    write_text_arith(f, l, sampled);
+    fclose(f);
+    return;
+  }
+
+  fprintf(f, "%sid,marked,silent,total%s\n", only_records ? "" : "module,",
+          sampled ? ",silent_lo,silent_hi" : "");
+
+  for (unsigned i = 0; i < l->size; i++) {
+    prof_entry *e = &l->e[i];
+    for (unsigned j = 0; j < e->m.num_sites; j++) {
+      if (!only_records)
+        fprintf(f, "%llx,", (unsigned long long)e->m.module_hash);
+      fprintf(f, "%u,%d,", j, e->info[j]);
+      phoenix_prof_print_counts(f, e->counters[2 * j], e->counters[2 * j + 1], e->m.sample_rate, sampled);
+      fprintf(f, "\n");
+    }
   }
   fprintf(f, "\n");
 
   fclose(f);
+}
 
+// A process may flush more than once (periodic flush, `dump_*` calls from
+// old instrumented binaries). When merging, only add what changed since the
+// last flush, otherwise the same executions would be counted twice
+static prof_list flushed[PHOENIX_NUM_KINDS];
+
+void remove_flushed(unsigned kind, prof_list *l){
+  prof_list current = {0, NULL};
+  for (unsigned i = 0; i < l->size; i++)
+    merge_prof_entry(&current, &l->e[i]);
+
+  for (unsigned i = 0; i < l->size; i++) {
+    prof_entry *e = &l->e[i];
+    prof_entry *prev = find_prof_entry(&flushed[kind], e->m.module_hash, e->m.kind);
+    if (prev == NULL || prev->m.num_sites != e->m.num_sites)
+      continue;
+
+    if (kind != PHOENIX_VALUE_COUNTERS) {
+      for (unsigned j = 0; j < 2 * e->m.num_sites; j++)
+        e->counters[j] -= prev->counters[j];
+      continue;
+    }
+
+    // Values may have been replaced since the last flush, so this is only
+    // an approximation of what changed
+    for (unsigned j = 0; j < e->m.num_sites; j++) {
+      unsigned long long *cur = &e->counters[j * e->m.counters_per_site];
+      unsigned long long *old = &prev->counters[j * e->m.counters_per_site];
+      cur[0] -= old[0];
+      for (unsigned a = 0; a < PHOENIX_VALUE_SLOTS; a++)
+        for (unsigned b = 0; b < PHOENIX_VALUE_SLOTS; b++)
+          if (old[2 + 2 * b] > 0 && cur[1 + 2 * a] == old[1 + 2 * b])
+            cur[2 + 2 * a] = cur[2 + 2 * a] > old[2 + 2 * b] ? cur[2 + 2 * a] - old[2 + 2 * b] : 0;
+    }
+  }
+
+  free_profile(&flushed[kind]);
+  flushed[kind] = current;
 }
 
+void write_profile(unsigned kind, prof_list *l){
+  char filename[PATH_MAX];
+
+  if (use_online_merge())
+    remove_flushed(kind, l);
 
+  if (!profile_per_module()) {
+    get_profile_filename(filename, sizeof(filename), kind, 0);
+    if (use_binary_profile())
+      write_binary_profile(filename, l);
+    else
+      write_text_profile(filename, kind, l);
+    return;
+  }
+
+  for (unsigned i = 0; i < l->size; i++) {
+    prof_list one = {1, &l->e[i]};
+    get_profile_filename(filename, sizeof(filename), kind, l->e[i].m.module_hash);
+    if (use_binary_profile())
+      write_binary_profile(filename, &one);
+    else
+      write_text_profile(filename, kind, &one);
+  }
+}
 
+// Serializes the flushes made at exit and by the flush thread
+static char flush_lock = 0;
 
+static void lock_flush(){
+  while (__atomic_test_and_set(&flush_lock, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+static void unlock_flush(){
+  __atomic_clear(&flush_lock, __ATOMIC_RELEASE);
+}
 
+// Writes the profile of @kind. The caller holds the flush lock: `r` and
+// `flushed` are only touched here
+static void flush_kind(unsigned kind){
+  if (kind == PHOENIX_STORE_COUNTERS)
+    merge_records();
+
+  prof_list l = {0, NULL};
+  collect_profile(kind, &l);
+  write_profile(kind, &l);
+  free_profile(&l);
+}
+
+void dump_records(){
+  lock_flush();
+  flush_kind(PHOENIX_STORE_COUNTERS);
+  unlock_flush();
+}
+
+void dump_arith(){
+  lock_flush();
+  flush_kind(PHOENIX_ARITH_COUNTERS);
+  unlock_flush();
+}
+
+void dump_values(){
+  lock_flush();
+  flush_kind(PHOENIX_VALUE_COUNTERS);
+  unlock_flush();
+}
+
+//
+// Flushing
+//
+
+// Defined so that modules with inline counters pull this file out of the
+// static library (see Instrumentation/InlineCounters.cpp)
+int __phoenix_runtime = 0;
+
+static int exiting = 0;
+
+// Only dump what this program was instrumented for. The caller holds the
+// flush lock
+static void flush_all(){
+  if (num_static_stores > 0 || has_shard_data(PHOENIX_STORE_COUNTERS) ||
+      has_module_data(PHOENIX_STORE_COUNTERS))
+    flush_kind(PHOENIX_STORE_COUNTERS);
+
+  if (num_static_arith > 0 || has_shard_data(PHOENIX_ARITH_COUNTERS) ||
+      has_module_data(PHOENIX_ARITH_COUNTERS))
+    flush_kind(PHOENIX_ARITH_COUNTERS);
+
+  if (num_static_values > 0 || has_shard_data(PHOENIX_VALUE_COUNTERS))
+    flush_kind(PHOENIX_VALUE_COUNTERS);
+}
+
+void phoenix_flush(){
+  lock_flush();
+  flush_all();
+  unlock_flush();
+}
+
+// A flush thread that wakes up after this sees `exiting` and does not write
+// the files again while the process tears down
+static void flush_at_exit(){
+  lock_flush();
+  exiting = 1;
+  flush_all();
+  unlock_flush();
+}
+
+// Reads the counters only under the flush lock, and the shards only through
+// the blocks published by their owner threads (see collect.h)
+static void *flush_thread(void *arg){
+  unsigned seconds = (unsigned)(uintptr_t)arg;
+  for (;;) {
+    sleep(seconds);
+
+    lock_flush();
+    int done = exiting;
+    if (!done)
+      flush_all();
+    unlock_flush();
+
+    if (done)
+      return NULL;
+  }
+}
+
+// Priority 101 runs before the constructors of default priority, the ones of
+// the program's static objects among them. The atexit handlers run in the
+// reverse order of their registration, so the flush runs after the
+// destructors of those objects, which may still execute instrumented code.
+// Shared libraries are initialized before the program: their destructors
+// run after the flush
+__attribute__((constructor(101))) static void phoenix_init(){
+  atexit(flush_at_exit);
+
+  const char *interval = getenv("PHOENIX_FLUSH_INTERVAL");
+  int seconds = interval ? atoi(interval) : 0;
+  if (seconds <= 0)
+    return;
+
+  if (pthread_create == NULL) {
+    fprintf(stderr, "phoenix: PHOENIX_FLUSH_INTERVAL needs the program to be linked with -pthread\n");
+    return;
+  }
+
+  pthread_t t;
+  if (pthread_create(&t, NULL, flush_thread, (void*)(uintptr_t)seconds) == 0)
+    pthread_detach(t);
+}
@@ -14,6 +14,7 @@
 
 // This file includes an Enum saying which operand is the target operand
 #include "../Identify/Position.h" 
+#include "profile_format.h"
 
 #define FILENAME "store_count.txt"
 // #define MAX 100000
@@ -47,8 +48,6 @@ void dump_txt();
 
 //
 
-enum ID_TYPES { NONE = 0, ID_A = 1, ID_B = 2, BOTH = 3 };
-
 #define max(a, b)                                                              \
   ({                                                                           \
     __typeof__(a) _a = (a);                                                    \
@@ -56,61 +55,110 @@ enum ID_TYPES { NONE = 0, ID_A = 1, ID_B = 2, BOTH = 3 };
     _a > _b ? _a : _b;                                                         \
   })
 
-#define LL(a) (*(long long *)(a))
-
-#define DB(a) (*(double *)(a))
-
 #define assertf(A, M, ...) if(!(A)) \
  { fprintf(stderr, M, ##__VA_ARGS__); fprintf(stderr, "\n"); assert(A); }
 
 
-typedef struct {
-  long long cnt_id;     // The number of times this instruction was executed with an
-                        // identity
-  long long cnt_wi;     // The number of times this instruction was executed without
-                        // an identity
+//
+// Arithmetic identities (CountArith)
+//
+// One entry point per (type, opcode), e.g. `record_arith_i32_add`. The pass
+// picks it at compile time, so the runtime neither extends the operands nor
+// searches for the opcode. `op_pos` tells whether `a` (FIRST) or `b`
+// (SECOND) is the value loaded from the address being written:
+//   *p = *p `op` v  or  *p = v `op` *p
+// and the execution has an identity when `v` is the identity of `op`.
+//
+// Opcodes are the ones of LLVM 6 (llvm/IR/Instruction.def)
+//
+
+#define PHOENIX_IDENTITY_COMMUTATIVE(e) (op_pos == SECOND ? a == (e) : b == (e))
+#define PHOENIX_IDENTITY_RIGHT(e) (op_pos == FIRST && b == (e))
+#define PHOENIX_IDENTITY_SAME(e) (a == b)
+
+// X(type, C type, opcode name, opcode, identity check)
+#define PHOENIX_INT_ARITH(X, TY, T)                   \
+  X(TY, T, add, 11, PHOENIX_IDENTITY_COMMUTATIVE(0))  \
+  X(TY, T, sub, 13, PHOENIX_IDENTITY_RIGHT(0))        \
+  X(TY, T, mul, 15, PHOENIX_IDENTITY_COMMUTATIVE(1))  \
+  X(TY, T, udiv, 17, PHOENIX_IDENTITY_RIGHT(1))       \
+  X(TY, T, sdiv, 18, PHOENIX_IDENTITY_RIGHT(1))       \
+  X(TY, T, shl, 23, PHOENIX_IDENTITY_RIGHT(0))        \
+  X(TY, T, lshr, 24, PHOENIX_IDENTITY_RIGHT(0))       \
+  X(TY, T, ashr, 25, PHOENIX_IDENTITY_RIGHT(0))       \
+  X(TY, T, and, 26, PHOENIX_IDENTITY_SAME(0))         \
+  X(TY, T, or, 27, PHOENIX_IDENTITY_SAME(0))          \
+  X(TY, T, xor, 28, PHOENIX_IDENTITY_COMMUTATIVE(0))
 
-  long long a, b, both; // The number of times the operand a or b are the
-                        // identity Note that cnt_id = a + b;
-} dynamic_execution;
+#define PHOENIX_FP_ARITH(X, TY, T)                    \
+  X(TY, T, fadd, 12, PHOENIX_IDENTITY_COMMUTATIVE(0)) \
+  X(TY, T, fsub, 14, PHOENIX_IDENTITY_RIGHT(0))       \
+  X(TY, T, fmul, 16, PHOENIX_IDENTITY_COMMUTATIVE(1)) \
+  X(TY, T, fdiv, 19, PHOENIX_IDENTITY_RIGHT(1))
+
+#define PHOENIX_ARITH(X)                \
+  PHOENIX_INT_ARITH(X, i8, signed char) \
+  PHOENIX_INT_ARITH(X, i16, short)      \
+  PHOENIX_INT_ARITH(X, i32, int)        \
+  PHOENIX_INT_ARITH(X, i64, long long)  \
+  PHOENIX_FP_ARITH(X, f32, float)       \
+  PHOENIX_FP_ARITH(X, f64, double)
+
+#define PHOENIX_DECLARE_ARITH(TY, T, OP, OPCODE, IDENTITY) \
+  void record_arith_##TY##_##OP(unsigned id, T a, T b, unsigned op_pos);
+
+PHOENIX_ARITH(PHOENIX_DECLARE_ARITH)
 
 typedef struct {
-  char *name;
   unsigned opcode;
-  unsigned long long identity_exec;
-  unsigned long long total_exec;
+  unsigned long long identity;
+  unsigned long long total;
+} arith_counter;
 
-  //
-  unsigned size;
-  dynamic_execution *dyn;
-} arithmetic_inst;
+// Number of instructions, as computed by the CountArith pass. Each module
+// calls `init_arith` from a constructor, so the shards (see below) are
+// created with the right size and `record_arith_*` never has to resize them
+static unsigned num_static_arith = 0;
 
-#define LENGTH 15
+void init_arith(unsigned num_sites);
 
-static arithmetic_inst data[LENGTH] = {
-    {"Add", 11, 0, 0, 0, NULL},  {"FAdd", 12, 0, 0, 0, NULL}, {"Sub", 13, 0, 0, 0, NULL},
-    {"FSub", 14, 0, 0, 0, NULL}, {"Mul", 15, 0, 0, 0, NULL},  {"FMul", 16, 0, 0, 0, NULL},
-    {"Xor", 28, 0, 0, 0, NULL},  {"Shl", 23, 0, 0, 0, NULL},  {"LShr", 24, 0, 0, 0, NULL},
-    {"AShr", 25, 0, 0, 0, NULL}, {"UDiv", 17, 0, 0, 0, NULL}, {"SDiv", 18, 0, 0, 0, NULL},
-    {"And", 26, 0, 0, 0, NULL},  {"Or", 27, 0, 0, 0, NULL}, {"FDiv", 19, 0, 0, 0, NULL},
+// arith.txt sums the instructions per opcode, one row each, in this order:
+//   Instruction,static_instances,dyn_eq,dyn_total
+// The counters of each instruction are in the binary profile
+// (`phoenix-profdata show -kind=arith`)
+#define PHOENIX_ARITH_ROWS 15
+
+static const struct {
+  const char *name;
+  unsigned opcode;
+} arith_rows[PHOENIX_ARITH_ROWS] = {
+    {"Add", 11},  {"FAdd", 12}, {"Sub", 13},  {"FSub", 14}, {"Mul", 15},
+    {"FMul", 16}, {"Xor", 28},  {"Shl", 23},  {"LShr", 24}, {"AShr", 25},
+    {"UDiv", 17}, {"SDiv", 18}, {"And", 26},  {"Or", 27},   {"FDiv", 19},
 };
 
-int has_identity(unsigned opcode, void *a, void *b, unsigned op_pos);
-dynamic_execution *resize(dynamic_execution *dyn, int curr_size, int new_size);
-void record_id_individually(arithmetic_inst *ai, long long static_id,
-                            int is_identity);
-unsigned get_index(unsigned opcode);
-void record_arith(unsigned opcode, long long static_id, void *a, void *b,
-                  void *dest_address, void *op_address, unsigned op_pos);
-void record_arith_int(unsigned opcode, long long static_id, long long a,
-                      long long b, void *dest_address, void *op_address,
-                      unsigned op_pos);
-void record_arith_float(unsigned opcode, long long static_id, double a,
-                        double b, void *dest_address, void *op_address,
-                        unsigned op_pos);
+//
+// Value profiling (CountArith -phoenix-value-profile)
+//
+// Keeps the PHOENIX_VALUE_SLOTS most frequent values of `v` at each site
+// using the space-saving sketch: a value not in the table replaces the least
+// frequent one and inherits its count (so counts are upper bounds). Memory
+// per site is fixed. Integers are sign-extended to 64 bits; floating point
+// values are passed as the bits of a double (@is_fp).
+//
 
+typedef struct {
+  unsigned long long c[1 + 2 * PHOENIX_VALUE_SLOTS];  // total, {value, count}...
+  unsigned is_fp;
+} value_site;
 
-//
+// Sized by `init_values` and sharded per thread like the arith counters.
+// Each thread keeps its own sketch, they are merged when dumped
+static unsigned num_static_values = 0;
+
+void init_values(unsigned num_sites);
+void record_value(unsigned id, unsigned long long value, unsigned is_fp);
+void dump_values();
 
 typedef struct {
   unsigned store_id;
@@ -119,11 +167,174 @@ typedef struct {
   unsigned long long total;
 } record;
 
+// Merged view of every shard below. Only built by `dump_records`
 unsigned __size = 0;
 
 record *r = NULL;
 
+//
+// Counters are sharded per thread: each thread increments its own copy and
+// the shards are only summed up when the profile is dumped. This way,
+// `record_store`, `record_arith_*` and `record_value` never take a lock nor
+// execute an atomic RMW.
+//
+//  shards -> shard(T3) -> shard(T2) -> shard(T1) -> NULL
+//
+// A shard is pushed (CAS) on the list the first time its thread records
+// something and it is never freed, so counts of finished threads are kept.
+//
+
+typedef struct {
+  unsigned long long silent;
+  unsigned long long total;
+  unsigned is_marked;
+} store_counter;
+
+// The counters live in a block that is replaced as a whole when it grows.
+// Readers (dump) see either the old or the new block, never a half-copied one.
+// Old blocks are not freed since a concurrent dump may still be reading them.
+typedef struct {
+  unsigned size;
+  store_counter c[];
+} store_block;
+
+// Same, for the instructions recorded by `record_arith_*`
+typedef struct {
+  unsigned size;
+  arith_counter c[];
+} arith_block;
+
+typedef struct {
+  unsigned size;
+  value_site c[];
+} value_block;
+
+typedef struct shard {
+  struct shard *next;
+  store_block *stores;
+  arith_block *arith;
+  value_block *values;
+} shard;
+
+static shard *shards = NULL;
+static __thread shard *local_shard = NULL;
+
+// Number of static stores, as computed by the CountStores pass. Each
+// instrumented module calls `init_records` from a constructor, so shards are
+// created with the right size and `record_store` never has to resize them.
+static unsigned num_static_stores = 0;
+
+shard *get_shard();
+store_block *grow_store_block(shard *s, unsigned new_size);
+arith_block *grow_arith_block(shard *s, unsigned new_size);
+value_block *grow_value_block(shard *s, unsigned new_size);
+int has_shard_data(unsigned kind);
+
+//
+// Inline counters (-phoenix-inline-counters)
+//
+// Instead of calling `record_store`/`record_arith_*`, each instrumented module
+// keeps its own array of counters and increments it inline. The pass also
+// emits one `phoenix_module_data` per module in the `phoenix_data` section.
+// The linker puts them next to each other and we walk them with the
+// __start_/__stop_ symbols it defines. Keep it in sync with
+// Instrumentation/InlineCounters.cpp
+//
+
+typedef struct {
+  unsigned long long module_hash;
+  unsigned kind;
+  unsigned num_sites;
+  unsigned long long *counters;  // {hits, total} for each site
+  const unsigned char *info;     // is_marked (stores) or the opcode (arith)
+  unsigned sample_rate;          // -phoenix-sample-rate, 1 when not sampling
+} phoenix_module_data;
+
+extern phoenix_module_data __start_phoenix_data __attribute__((weak));
+extern phoenix_module_data __stop_phoenix_data __attribute__((weak));
+
+#define FOR_EACH_MODULE_DATA(d, k)                                                 \
+  for (phoenix_module_data *d = &__start_phoenix_data; d < &__stop_phoenix_data; d++) \
+    if (d->kind == (k))
+
+int has_module_data(unsigned kind);
+void dump_arith();
+
+//
+// Sampling (-phoenix-sample-rate=N)
+//
+// Only bursts of executions are profiled, roughly 1 out of N. The counts are
+// scaled back by N when dumped and a 95% confidence interval (Wilson score)
+// for the number of silent/identity executions is reported next to them.
+// Modules using `record_store` tell the rate through `set_sample_rate`; the
+// inline ones keep it in their `phoenix_module_data`.
+//
+
+static unsigned sample_rate = 1;
+
+void set_sample_rate(unsigned rate);
+
+//
+// Profile files
+//
+// `dump_records` and `dump_arith` write store.txt and arith.txt by default.
+//
+//   PHOENIX_PROFILE_FORMAT=binary  write the format described in
+//                                  profile_format.h instead (.profraw), see
+//                                  ProfData/ for the tool that reads it
+//   PHOENIX_PROFILE_FILE=pattern   file name to use. %p is replaced by the
+//                                  pid, %h by the hostname, %k by store,
+//                                  arith or values and %m by the module hash
+//                                  (one file per module)
+//   PHOENIX_PROFILE_MERGE=1        lock the file and add the counters to the
+//                                  ones already there (implies binary)
+//
+
+// Counters of one module, as read from or written to a profile
+typedef struct {
+  phoenix_prof_module m;
+  unsigned char *info;
+  unsigned long long *counters;  // {hits, total} for each site
+} prof_entry;
+
+typedef struct {
+  unsigned size;
+  prof_entry *e;
+} prof_list;
+
+int use_online_merge();
+int use_binary_profile();
+const char *kind_name(unsigned kind);
+int profile_per_module();
+void get_profile_filename(char *buf, size_t size, unsigned kind, unsigned long long module_hash);
+
+prof_entry *add_prof_entry(prof_list *l, unsigned long long module_hash, unsigned kind,
+                           unsigned num_sites, unsigned rate);
+prof_entry *find_prof_entry(prof_list *l, unsigned long long module_hash, unsigned kind);
+void free_profile(prof_list *l);
+void collect_profile(unsigned kind, prof_list *l);
+void merge_prof_entry(prof_list *l, const prof_entry *src);
+uint8_t *encode_profile(prof_list *l, size_t *size);
+int decode_profile(const uint8_t *buf, size_t size, prof_list *l);
+void write_binary_profile(const char *filename, prof_list *l);
+void write_text_profile(const char *filename, unsigned kind, prof_list *l);
+void remove_flushed(unsigned kind, prof_list *l);
+void write_profile(unsigned kind, prof_list *l);
+
+//
+// The profile is flushed when the program exits (`atexit`, registered from a
+// constructor), no matter how many modules were instrumented. Programs that
+// leave through `_exit`/`abort`, or never finish, can call `phoenix_flush`
+// themselves or set PHOENIX_FLUSH_INTERVAL=<seconds> to get a background
+// thread flushing periodically.
+//
+
+void phoenix_flush();
+
+void init_records(unsigned total_static_stores);
 void realloc_records(unsigned new_size);
+void merge_records();
+store_block *record_store_slow(unsigned store_id);
 void record_store(unsigned store_id, unsigned is_marked, int is_equals);
 void dump_records();
 
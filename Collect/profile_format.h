@@ -0,0 +1,241 @@
+// Binary profile format, written by the Collect runtime and read by
+// ProfData/phoenix-profdata. Shared between C and C++, keep it that way.
+//
+//  +--------------------------+
+//  | phoenix_prof_header      |  magic, version, number of modules
+//  +--------------------------+
+//  | phoenix_prof_module[0]   |  index: one fixed size entry per module,
+//  | ...                      |  pointing to its payload
+//  | phoenix_prof_module[n-1] |
+//  +--------------------------+
+//  | payload[0]               |  num_sites bytes of info (is_marked/opcode)
+//  | ...                      |  followed by the counters of each site,
+//  | payload[n-1]             |  ULEB128 encoded
+//  +--------------------------+
+//
+// The header and the index are naturally aligned, so a profile can be
+// mmap'ed and the index used in place. Integers are little-endian.
+// Counters are raw: when `sample_rate` > 1 they must be scaled back.
+//
+// Counters of a site:
+//   stores, arith: {hits, total}
+//   values:        {total, value[0], count[0], ..., value[K-1], count[K-1]}
+//                  the K most frequent values (space-saving sketch). Info
+//                  is 1 when the values are the bits of a double
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PHOENIX_PROF_MAGIC "PHXPROF"
+#define PHOENIX_PROF_VERSION 2
+
+// Keep in sync with Instrumentation/InlineCounters.h
+enum COUNTER_KIND {
+  PHOENIX_STORE_COUNTERS = 0,
+  PHOENIX_ARITH_COUNTERS = 1,
+  PHOENIX_VALUE_COUNTERS = 2,
+  PHOENIX_NUM_KINDS
+};
+
+// Values kept per site by the value profiler
+#define PHOENIX_VALUE_SLOTS 8
+
+// Upper bound on the size of an ULEB128 encoded uint64_t
+#define PHOENIX_PROF_MAX_VARINT 10
+
+typedef struct {
+  char magic[8];  // PHOENIX_PROF_MAGIC, '\0' terminated
+  uint32_t version;
+  uint32_t num_modules;
+} phoenix_prof_header;
+
+typedef struct {
+  uint64_t module_hash;  // 0 for stores recorded through `record_store`
+  uint32_t kind;         // COUNTER_KIND
+  uint32_t num_sites;
+  uint32_t sample_rate;
+  uint32_t size;    // size of the payload, in bytes
+  uint64_t offset;  // from the beginning of the file
+  uint32_t counters_per_site;
+  uint32_t reserved;
+} phoenix_prof_module;
+
+static inline uint32_t phoenix_prof_counters_per_site(uint32_t kind) {
+  return kind == PHOENIX_VALUE_COUNTERS ? 1 + 2 * PHOENIX_VALUE_SLOTS : 2;
+}
+
+static inline void phoenix_prof_init_header(phoenix_prof_header *h, uint32_t num_modules) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, PHOENIX_PROF_MAGIC, sizeof(PHOENIX_PROF_MAGIC));
+  h->version = PHOENIX_PROF_VERSION;
+  h->num_modules = num_modules;
+}
+
+static inline int phoenix_prof_check_header(const phoenix_prof_header *h) {
+  return memcmp(h->magic, PHOENIX_PROF_MAGIC, sizeof(PHOENIX_PROF_MAGIC)) == 0 &&
+         h->version == PHOENIX_PROF_VERSION;
+}
+
+// Writes @value at @p and returns the number of bytes used
+static inline unsigned phoenix_prof_encode(uint64_t value, uint8_t *p) {
+  unsigned n = 0;
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0)
+      byte |= 0x80;
+    p[n++] = byte;
+  } while (value != 0);
+  return n;
+}
+
+// Reads a value from *@p, advancing it. Returns 0 on a truncated input
+static inline int phoenix_prof_decode(const uint8_t **p, const uint8_t *end, uint64_t *value) {
+  uint64_t result = 0;
+  unsigned shift = 0;
+  const uint8_t *q = *p;
+
+  while (q < end && shift < 64) {
+    uint8_t byte = *q++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    shift += 7;
+    if ((byte & 0x80) == 0) {
+      *p = q;
+      *value = result;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Adds the value histogram of a site @src to @dst, keeping the
+// PHOENIX_VALUE_SLOTS most frequent values
+static inline void phoenix_prof_merge_values(uint64_t *dst, const uint64_t *src) {
+  uint64_t all[4 * PHOENIX_VALUE_SLOTS];
+  unsigned n = 0;
+
+  for (unsigned i = 0; i < PHOENIX_VALUE_SLOTS; i++)
+    if (dst[2 + 2 * i] > 0) {
+      all[2 * n] = dst[1 + 2 * i];
+      all[2 * n + 1] = dst[2 + 2 * i];
+      n++;
+    }
+
+  for (unsigned i = 0; i < PHOENIX_VALUE_SLOTS; i++) {
+    uint64_t value = src[1 + 2 * i], count = src[2 + 2 * i];
+    if (count == 0)
+      continue;
+
+    unsigned j = 0;
+    while (j < n && all[2 * j] != value)
+      j++;
+    if (j == n) {
+      all[2 * n] = value;
+      all[2 * n + 1] = 0;
+      n++;
+    }
+    all[2 * j + 1] += count;
+  }
+
+  // selection sort by count, there are at most 2 * PHOENIX_VALUE_SLOTS values
+  for (unsigned i = 0; i < PHOENIX_VALUE_SLOTS; i++) {
+    unsigned best = i;
+    for (unsigned j = i + 1; j < n; j++)
+      if (all[2 * j + 1] > all[2 * best + 1])
+        best = j;
+
+    if (i < n) {
+      uint64_t value = all[2 * best], count = all[2 * best + 1];
+      all[2 * best] = all[2 * i];
+      all[2 * best + 1] = all[2 * i + 1];
+      dst[1 + 2 * i] = value;
+      dst[2 + 2 * i] = count;
+    } else {
+      dst[1 + 2 * i] = 0;
+      dst[2 + 2 * i] = 0;
+    }
+  }
+
+  dst[0] += src[0];
+}
+
+// Newton's method, so that the runtime does not need libm
+static inline double phoenix_prof_sqrt(double x) {
+  if (x <= 0.0)
+    return 0.0;
+  double y = x > 1.0 ? x : 1.0;
+  for (int i = 0; i < 64; i++)
+    y = 0.5 * (y + x / y);
+  return y;
+}
+
+// 95% Wilson score interval of the number of hits, given @hits out of @total
+// sampled executions and a sample rate of @rate
+static inline void phoenix_prof_interval(uint64_t hits, uint64_t total, uint32_t rate,
+                                         uint64_t *lo, uint64_t *hi) {
+  if (total == 0) {
+    *lo = *hi = 0;
+    return;
+  }
+
+  const double z = 1.96;
+  double n = (double)total;
+  double p = (double)hits / n;
+  double denom = 1.0 + z * z / n;
+  double center = (p + z * z / (2.0 * n)) / denom;
+  double half = z * phoenix_prof_sqrt(p * (1.0 - p) / n + z * z / (4.0 * n * n)) / denom;
+
+  double l = center - half < 0.0 ? 0.0 : center - half;
+  double h = center + half > 1.0 ? 1.0 : center + half;
+  double scaled_total = n * (rate ? rate : 1);
+
+  *lo = (uint64_t)(l * scaled_total);
+  *hi = (uint64_t)(h * scaled_total + 0.5);
+}
+
+// Text output, shared by the runtime and phoenix-profdata so that both print
+// the same rows
+
+// "hits,total" scaled by @rate, followed by the bounds of the interval of the
+// hits when @sampled
+static inline void phoenix_prof_print_counts(FILE *f, uint64_t hits, uint64_t total,
+                                             uint32_t rate, int sampled) {
+  if (rate == 0)
+    rate = 1;
+
+  fprintf(f, "%llu,%llu", (unsigned long long)(hits * rate), (unsigned long long)(total * rate));
+  if (!sampled)
+    return;
+
+  uint64_t lo, hi;
+  phoenix_prof_interval(hits, total, rate, &lo, &hi);
+  fprintf(f, ",%llu,%llu", (unsigned long long)lo, (unsigned long long)hi);
+}
+
+// One "module,id,total,value,count" row per recorded value of site @id, whose
+// counters are @c. Values are doubles when @is_fp
+static inline void phoenix_prof_print_values(FILE *f, uint64_t module_hash, unsigned id,
+                                             uint8_t is_fp, const uint64_t *c, uint32_t rate) {
+  if (rate == 0)
+    rate = 1;
+
+  for (unsigned k = 0; k < PHOENIX_VALUE_SLOTS; k++) {
+    if (c[2 + 2 * k] == 0)
+      continue;
+
+    fprintf(f, "%llx,%u,%llu,", (unsigned long long)module_hash, id,
+            (unsigned long long)(c[0] * rate));
+    if (is_fp) {
+      double d;
+      memcpy(&d, &c[1 + 2 * k], sizeof(d));
+      fprintf(f, "%g", d);
+    } else {
+      fprintf(f, "%lld", (long long)c[1 + 2 * k]);
+    }
+    fprintf(f, ",%llu\n", (unsigned long long)(c[2 + 2 * k] * rate));
+  }
+}
@@ -1,11 +1,11 @@
 #include "llvm/ADT/Statistic.h" // For the STATISTIC macro.
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemorySSA.h"
-#include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/Constants.h"         // For ConstantData, for instance.
 #include "llvm/IR/DebugInfoMetadata.h" // For DILocation
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h" // To use the iterator instructions(f)
 #include "llvm/IR/Instructions.h" // To have access to the Instructions.
@@ -13,215 +13,292 @@
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/Passes/PassPlugin.h"
+#endif
 #include "llvm/Support/Debug.h" // To print error messages.
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h" // For dbgs()
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToGlobalCtors
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <stack>
+#include <string>
 
 using std::set;
 using std::stack;
 
 #include "Count.h"
+#include "../Support/Compat.h"
 
 #define DEBUG_TYPE "Count"
 
-void Count::dump() {
-
-  std::vector<Instruction*> vec;
-  for (auto &it : mapa){
-    vec.push_back (it.first);
-  }
-
-  sort(begin(vec), end(vec), [](const Instruction *a, const Instruction *b){
-    return a->getOpcode() > b->getOpcode();
-  });
-
-  for (Instruction *I : vec) {
-    unsigned id = mapa[I];
-    const DebugLoc &loc = I->getDebugLoc();
-
-    if (loc) {
-      auto *Scope = cast<DIScope>(loc.getScope());
-      errs() << "Assigning " << id << " to " << *I << " ["
-             << Scope->getFilename() << ":" << loc.getLine() << "]"
-             << "\n";
-    } else
-      errs() << "Assigning " << id << " to " << *I << "\n";
-  }
-
-  printf("\n");
-  // errs() << "\n";
+static cl::opt<bool> ValueProfile("phoenix-value-profile",
+                                  cl::desc("Record the most frequent values of `v` at each site"),
+                                  cl::init(false));
+
+// Name of the runtime entry point recording @I, e.g. `record_arith_i32_add`.
+// Vectors use the one of their elements. Empty when the runtime has none for
+// the type of @I
+static std::string get_entry_point(Instruction *I) {
+  Type *T = I->getType()->getScalarType();
+
+  // fmuladd(a, b, *p) is recorded as the fadd of a * b and *p
+  StringRef opcode = is_fused_mul_add(I) ? "fadd" : I->getOpcodeName();
+  std::string type;
+
+  if (T->isFloatTy())
+    type = "f32";
+  else if (T->isDoubleTy())
+    type = "f64";
+  else if (T->isIntegerTy(8) || T->isIntegerTy(16) || T->isIntegerTy(32) || T->isIntegerTy(64))
+    type = "i" + std::to_string(T->getIntegerBitWidth());
+  else
+    return "";
+
+  return "record_arith_" + type + "_" + opcode.str();
 }
 
-unsigned Count::get_id(Instruction *I){
-  if (mapa.find(I) == mapa.end()){
-    assign_id(I);
-  }
-  assert(mapa.find(I) != mapa.end());
-  return mapa[I];
-}
+// `v` of *p = *p `op` v. For a fused multiply-add, the product a * b is
+// computed at the insertion point
+static Value *get_v(IRBuilder<> &Builder, Geps &g) {
+  if (!g.is_fused())
+    return g.get_v();
 
-void Count::assign_id(Instruction *I){
-  assert(mapa.find(I) == mapa.end() && "Instruction already exists on map<Instruction*, unsigned>");
-  unsigned opcode = I->getOpcode();
-  mapa[I] = ++opcode_counter[opcode];;
+  Instruction *I = g.get_instruction();
+  return Builder.CreateFMul(I->getOperand(0), I->getOperand(1), "phoenix.fmul");
 }
 
-void Count::track_int(Module &M, Instruction *I, Value *op1, Value *op2,
-                      Geps &g) {
+void Count::track_call(Module &M, Geps &g, unsigned site, IRBuilder<> &Builder, Value *v) {
+  Instruction *I = g.get_instruction();
+  std::string name = get_entry_point(I);
 
-  IRBuilder<> Builder(g.get_store_inst()); // Store is the insertion point
+  LLVMContext &Ctx = M.getContext();
+  Type *T = I->getType()->getScalarType();
 
-  Constant *const_function = M.getOrInsertFunction(
-      "record_arith_int", FunctionType::getVoidTy(M.getContext()),
-      Type::getInt64Ty(M.getContext()),   // opcode
-      Type::getInt64Ty(M.getContext()),   // ID
-      Type::getInt64Ty(M.getContext()),   // op1
-      Type::getInt64Ty(M.getContext()),   // op2
-      Type::getInt8PtrTy(M.getContext()), // dest_address
-      Type::getInt8PtrTy(M.getContext()), // op_address
-      Type::getInt32Ty(M.getContext()));  // operand_pos
+  Constant *const_function =
+      phoenix::get_or_insert_function(&M, name, FunctionType::getVoidTy(Ctx),
+                                      Type::getInt32Ty(Ctx),   // ID
+                                      T,                       // a
+                                      T,                       // b
+                                      Type::getInt32Ty(Ctx));  // operand_pos
 
   Function *f = cast<Function>(const_function);
 
-  Value *se1 = op1->getType()->isIntegerTy(64)
-                   ? op1
-                   : Builder.CreateSExt(op1, Builder.getInt64Ty());
-  Value *se2 = op2->getType()->isIntegerTy(64)
-                   ? op2
-                   : Builder.CreateSExt(op2, Builder.getInt64Ty());
-
-  // Create the call
-  std::vector<Value *> params;
-  params.push_back(Builder.getInt64(I->getOpcode())); // opcode
-  params.push_back(Builder.getInt64(get_id(I)));      // ID
-  params.push_back(se1);                              // value1
-  params.push_back(se2);                              // value2
-  params.push_back(
-      Builder.CreateBitCast(g.get_dest_gep(), Builder.getInt8PtrTy())); // destiny GEP
-  params.push_back(
-      Builder.CreateBitCast(g.get_op_gep(), Builder.getInt8PtrTy())); // destiny GEP
-  params.push_back(Builder.getInt32(g.get_operand_pos())); // Operand pos (1 or 2)
-  CallInst *call = Builder.CreateCall(f, params);
+  // i8 and i16 are `signed char` and `short` in the runtime, the caller
+  // must extend them
+  bool sext = T->isIntegerTy() && T->getIntegerBitWidth() < 32;
+  if (sext)
+    for (unsigned arg : {1, 2})
+      f->addParamAttr(arg, Attribute::SExt);
+
+  Value *a = I->getOperand(0), *b = I->getOperand(1);
+  unsigned pos = g.get_operand_pos();
+  if (g.is_fused()) {
+    a = v;
+    b = g.get_p_before();
+    pos = SECOND;
+  }
+
+  // One call per lane, so vector instructions are counted lane-wise
+  for (unsigned lane = 0; lane < phoenix::get_num_lanes(I->getType()); lane++) {
+    std::vector<Value *> params;
+    params.push_back(Builder.getInt32(site));               // ID
+    params.push_back(phoenix::get_lane(Builder, a, lane));  // a
+    params.push_back(phoenix::get_lane(Builder, b, lane));  // b
+    params.push_back(Builder.getInt32(pos));                // Operand pos (1 or 2)
+    CallInst *call = Builder.CreateCall(f, params);
+
+    if (sext)
+      for (unsigned arg : {1, 2})
+        call->addParamAttr(arg, Attribute::SExt);
+  }
 }
 
-void Count::track_float(Module &M, Instruction *I, Value *op1, Value *op2,
-                        Geps &g) {
-  assert(op1->getType()->isFloatingPointTy());
-  assert(op2->getType()->isFloatingPointTy());
+// Records `v` (the operand that is not loaded from the address written) in
+// the value histogram of @site. Integers are sign-extended to i64, floating
+// point values are passed as the bits of a double
+void Count::track_value(Module &M, Geps &g, unsigned site, IRBuilder<> &Builder, Value *v) {
+  Type *T = g.get_instruction()->getType()->getScalarType();
 
-  IRBuilder<> Builder(g.get_store_inst()); // Store is the insertion point
+  LLVMContext &Ctx = M.getContext();
+  auto *I32Ty = Type::getInt32Ty(Ctx);
+  auto *I64Ty = Type::getInt64Ty(Ctx);
 
-  Constant *const_function = M.getOrInsertFunction(
-      "record_arith_float", FunctionType::getVoidTy(M.getContext()),
-      Type::getInt64Ty(M.getContext()),   // opcode
-      Type::getInt64Ty(M.getContext()),   // ID
-      Type::getDoubleTy(M.getContext()),  // op1
-      Type::getDoubleTy(M.getContext()),  // op2
-      Type::getInt8PtrTy(M.getContext()), // dest_address
-      Type::getInt8PtrTy(M.getContext()), // op_address
-      Type::getInt32Ty(M.getContext()));  // operand_pos
+  Constant *const_function =
+      phoenix::get_or_insert_function(&M, "record_value", FunctionType::getVoidTy(Ctx),
+                                      I32Ty,   // ID
+                                      I64Ty,   // value
+                                      I32Ty);  // is_fp
 
   Function *f = cast<Function>(const_function);
 
-  Value *se1 = op1->getType()->isDoubleTy()
-                   ? op1
-                   : Builder.CreateFPExt(op1, Builder.getDoubleTy());
-  Value *se2 = op2->getType()->isDoubleTy()
-                   ? op2
-                   : Builder.CreateFPExt(op2, Builder.getDoubleTy());
-
-  // Create the call
-  std::vector<Value *> params;
-  params.push_back(Builder.getInt64(I->getOpcode())); // opcode
-  params.push_back(Builder.getInt64(get_id(I)));      // ID
-  params.push_back(se1);                              // value1
-  params.push_back(se2);                              // value2
-  params.push_back(
-      Builder.CreateBitCast(g.get_dest_gep(), Builder.getInt8PtrTy())); // destiny GEP
-  params.push_back(
-      Builder.CreateBitCast(g.get_op_gep(), Builder.getInt8PtrTy())); // destiny GEP
-  params.push_back(Builder.getInt32(g.get_operand_pos())); // Operand pos (1 or 2)
-  CallInst *call = Builder.CreateCall(f, params);
+  for (unsigned lane = 0; lane < phoenix::get_num_lanes(v->getType()); lane++) {
+    Value *x = phoenix::get_lane(Builder, v, lane);
+    Value *bits;
+    if (T->isFloatingPointTy()) {
+      Value *d = T->isDoubleTy() ? x : Builder.CreateFPCast(x, Builder.getDoubleTy());
+      bits = Builder.CreateBitCast(d, I64Ty);
+    } else {
+      bits = Builder.CreateSExtOrTrunc(x, I64Ty);
+    }
+
+    Builder.CreateCall(f, {Builder.getInt32(site), bits, Builder.getInt32(T->isFloatingPointTy())});
+  }
 }
 
-// Create a call to `dump_arith` function
-void Count::insert_dump_call(Module &M, Instruction *I) {
-  IRBuilder<> Builder(I);
+// Creates a constructor that tells the runtime how many instructions this
+// module tracks, so that its table is allocated once
+void Count::insert_init_call(Module &M, const StringRef &function_name, unsigned num_sites) {
+  LLVMContext &Ctx = M.getContext();
 
-  // Let's create the function call
-  Constant *const_function = M.getOrInsertFunction(
-      "dump_arith", FunctionType::getVoidTy(M.getContext()));
+  Function *ctor = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                    GlobalValue::InternalLinkage, "phoenix." + function_name, &M);
+  BasicBlock *entry = BasicBlock::Create(Ctx, "entry", ctor);
+  IRBuilder<> Builder(entry);
+
+  Constant *const_function = phoenix::get_or_insert_function(
+      &M, function_name, FunctionType::getVoidTy(Ctx), Type::getInt32Ty(Ctx));  // num_sites
 
   Function *f = cast<Function>(const_function);
 
-  // Create the call
-  Builder.CreateCall(f, std::vector<Value *>());
+  Builder.CreateCall(f, {Builder.getInt32(num_sites)});
+  Builder.CreateRetVoid();
+
+  appendToGlobalCtors(M, ctor, 0);
 }
 
-// Find the return inst and create call to `dump_arith`
-void Count::insert_dump_call(Module &M) {
-  for (auto &F : M) {
-    for (auto &BB : F) {
-      for (auto &I : BB) {
-        if (ReturnInst *ri = dyn_cast<ReturnInst>(&I)) {
-          if (F.getName() == "main")
-            insert_dump_call(M, ri);
-        } else if (CallInst *ci = dyn_cast<CallInst>(&I)) {
-          Function *fun = ci->getCalledFunction();
-          if (fun && fun->getName() == "exit") {
-            insert_dump_call(M, ci);
-          }
-        }
-      }
-    }
-  }
+void Count::track_inline(Geps &g, unsigned site, phoenix::InlineCounters &counters,
+                         IRBuilder<> &Builder, Value *v) {
+  Value *identity = Identify::get_identity(g);
+
+  // Lane-wise for vectors, see InlineCounters::increment
+  Value *cmp = v->getType()->isFPOrFPVectorTy() ? Builder.CreateFCmpOEQ(v, identity)
+                                                : Builder.CreateICmpEQ(v, identity);
+
+  counters.set_info(site, g.is_fused() ? Instruction::FAdd : g.get_instruction()->getOpcode());
+  counters.increment(Builder, site, cmp);
 }
 
 bool Count::runOnModule(Module &M) {
+  return runImpl(
+      M,
+      [this](Function &F) -> Identify & {
+        return getAnalysis<IdentifyWrapperPass>(F).getIdentify();
+      });
+}
+
+bool Count::runImpl(Module &M, function_ref<Identify &(Function &)> GetIdentify) {
 
-  insert_dump_call(M);
+  std::vector<Geps> gs;
 
   for (auto &F : M) {
     if (F.isDeclaration() || F.isIntrinsic() ||
         F.hasAvailableExternallyLinkage())
       continue;
 
-    Identify *Idn = &getAnalysis<Identify>(F);
+    Identify *Idn = &GetIdentify(F);
 
-    llvm::SmallVector<Geps,10> gs = Idn->get_instructions_of_interest();
+    for (auto &g : Idn->get_instructions_of_interest())
+      gs.push_back(g);
+  }
 
-    // Let's give an id for each instruction of interest
-    for (auto &g : gs) {
-      Instruction *I = g.get_instruction();
-      errs() << "I: " << *I << "\n";
-      assign_id(I);
+  // Site hashes first, the instrumentation changes the ordinals
+  for (unsigned site = 0; site < gs.size(); site++)
+    sites.add(site, gs[site].get_instruction());
+  sites.write(M, phoenix::ARITH_COUNTERS);
+
+  // Value histograms always go through the runtime, ids are the same as the
+  // ones of the inline counters. Ids are dense, they index the tables of the
+  // runtime, the site map has the stable ones
+  std::unique_ptr<phoenix::InlineCounters> counters;
+  if (phoenix::UseInlineCounters)
+    counters.reset(new phoenix::InlineCounters(&M, phoenix::ARITH_COUNTERS, gs.size()));
+
+  for (unsigned site = 0; site < gs.size(); site++) {
+    Geps &g = gs[site];
+    bool call = !counters && !get_entry_point(g.get_instruction()).empty();
+    if (!ValueProfile && !counters && !call) {
+      LLVM_DEBUG(dbgs() << "No runtime entry point for " << *g.get_instruction() << "\n");
+      continue;
+    }
 
-      // sanity check for vector instructions
-      if (I->getOperand(0)->getType()->isVectorTy() ||
-          I->getOperand(1)->getType()->isVectorTy())
-        assert(0 && "Vector type");
+    // Store is the insertion point (or the sampled block right before it).
+    // One sampled region per site: its recorders share a tick of the clock
+    IRBuilder<> Builder(phoenix::sample_before(g.get_store_inst()));
+    Value *v = get_v(Builder, g);
+
+    if (ValueProfile)
+      track_value(M, g, site, Builder, v);
+    if (counters)
+      track_inline(g, site, *counters, Builder, v);
+    else if (call)
+      track_call(M, g, site, Builder, v);
+  }
 
-      if (I->getType()->isFloatingPointTy()) {
-        track_float(M, I, I->getOperand(0), I->getOperand(1), g);
-      } else {
-        track_int(M, I, I->getOperand(0), I->getOperand(1), g);
-      }
+  if (ValueProfile)
+    insert_init_call(M, "init_values", gs.size());
+
+  if (counters) {
+    for (auto &F : M) {
+      if (F.isDeclaration())
+        continue;
+      // sample_before split blocks, the LoopInfo of the pass manager is stale
+      DominatorTree DT(F);
+      LoopInfo LI(DT);
+      phoenix::promote_counters(F, LI, counters->get_counters());
     }
+
+    counters->finalize();
+  } else {
+    insert_init_call(M, "init_arith", gs.size());
   }
 
+  // Only the counters of the runtime (calls and value histograms) are scaled
+  // back by it
+  if (ValueProfile || !counters)
+    phoenix::insert_sample_rate_ctor(M);
+
   return false;
 }
 
 void Count::getAnalysisUsage(AnalysisUsage &AU) const {
-  AU.addRequired<Identify>();
+  AU.addRequired<IdentifyWrapperPass>();
   AU.setPreservesAll();
 }
 
 char Count::ID = 0;
 static RegisterPass<Count> X("CountArith", "Count pattern a = a OP b");
+
+PreservedAnalyses CountPass::run(Module &M, ModuleAnalysisManager &MAM) {
+  FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  Count pass;
+  pass.runImpl(
+      M,
+      [&FAM](Function &F) -> Identify & { return FAM.getResult<IdentifyAnalysis>(F); });
+
+  return PreservedAnalyses::none();
+}
+
+#if LLVM_VERSION_MAJOR >= 14
+// opt -load CountArith.so -load-pass-plugin CountArith.so -passes=phoenix-count-arith
+// (-load registers the options of the plugin)
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "CountArith", LLVM_VERSION_STRING, [](PassBuilder &PB) {
+            register_identify(PB);
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "phoenix-count-arith")
+                    return false;
+                  MPM.addPass(CountPass());
+                  return true;
+                });
+          }};
+}
+#endif
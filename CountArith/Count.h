@@ -2,42 +2,52 @@
 
 using namespace llvm;
 
-#include <map>
+#include "llvm/ADT/STLExtras.h"  // function_ref
+#include "llvm/IR/IRBuilder.h"
 #include "../Identify/Geps.h"
 #include "../Identify/Identify.h"
-
-using std::map;
+#include "../Identify/Lanes.h"
+#include "../Instrumentation/CounterPromotion.h"
+#include "../Instrumentation/InlineCounters.h"
+#include "../Instrumentation/Sampling.h"
+#include "../Instrumentation/SiteIds.h"
 
 class Count : public ModulePass {
 private:
-  map<Instruction*, unsigned> mapa;
-  map<unsigned, unsigned> opcode_counter;
-  
-  unsigned get_id(Instruction *I);
-  void assign_id(Instruction *I);
-
-  void dump();
+  phoenix::SiteMap sites;
 
 public:
   // Pass identifier, for LLVM's RTTI support:
   static char ID;
 
   bool runOnModule(Module &);
+  // Shared with CountPass
+  bool runImpl(Module &M, function_ref<Identify &(Function &)> GetIdentify);
+
 
-  void insert_dump_call(Module &M, Instruction *I);
-  void insert_dump_call(Module &M);
+  // The recorders insert their code with @Builder, in the sampled region of
+  // the site, and share @v, the `v` of @g computed there
 
-  // Assign a unique ID to each arithmetic instruction of the type:
-  //  - Add, Sub, Mul, Xor
+  // Adds a call to the runtime entry point specialized for the type and
+  // opcode of the instruction of @g (e.g. `record_arith_i32_add`)
+  void track_call(Module &M, Geps &g, unsigned site, IRBuilder<> &Builder, Value *v);
+  void insert_init_call(Module &M, const StringRef &function_name, unsigned num_sites);
 
-  // Adds a function call to a function defined externally which checks
-  // if op1 or op2 are the identity value of the instruction I
-  // Instruction I is **always** an arithmetic instruction
-  void track_int(Module &M, Instruction *I, Value *op1, Value *op2, Geps &g);
-  void track_float(Module &M, Instruction *I, Value *op1, Value *op2, Geps &g);
+  // Adds a call to `record_value`, which keeps the most frequent values of
+  // `v` at each site
+  void track_value(Module &M, Geps &g, unsigned site, IRBuilder<> &Builder, Value *v);
+
+  // Increments the module counters inline: hits counts when `v` is the identity
+  void track_inline(Geps &g, unsigned site, phoenix::InlineCounters &counters,
+                    IRBuilder<> &Builder, Value *v);
 
   void getAnalysisUsage(AnalysisUsage &AU) const;
 
   Count() : ModulePass(ID) {}
   ~Count() {}
 };
+
+// New pass manager
+struct CountPass : PassInfoMixin<CountPass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+};
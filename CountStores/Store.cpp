@@ -1,11 +1,11 @@
 #include "llvm/ADT/Statistic.h"  // For the STATISTIC macro.
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemorySSA.h"
-#include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/Constants.h"          // For ConstantData, for instance.
 #include "llvm/IR/DebugInfoMetadata.h"  // For DILocation
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstIterator.h"  // To use the iterator instructions(f)
 #include "llvm/IR/Instructions.h"  // To have access to the Instructions.
@@ -13,10 +13,14 @@
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/Passes/PassPlugin.h"
+#endif
 #include "llvm/Support/Debug.h"  // To print error messages.
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"  // For dbgs()
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToGlobalCtors
 
 #include <fstream>
 #include <iostream>
@@ -27,22 +31,10 @@ using std::set;
 using std::stack;
 
 #include "Store.h"
+#include "../Support/Compat.h"
 
 #define DEBUG_TYPE "StoreCount"
 
-unsigned Store::get_id(StoreInst *S) {
-  if (mapa.find(S) == mapa.end()) {
-    assign_id(S);
-  }
-  assert(mapa.find(S) != mapa.end());
-  return mapa[S];
-}
-
-void Store::assign_id(StoreInst *S) {
-  assert(mapa.find(S) == mapa.end() && "Instruction already exists on map<Instruction*, unsigned>");
-  mapa[S] = mapa.size();
-}
-
 template<class T>
 Value *get_constantint(Module *M, T num) {
   auto *I64Ty = Type::getInt64Ty(M->getContext());
@@ -51,21 +43,21 @@ Value *get_constantint(Module *M, T num) {
 
 
 void Store::create_call(Module *M,
-                        StoreInst *S,
+                        Instruction *InsertPt,
                         const StringRef &function_name,
                         Value *store_id,
                         Value *is_marked,
                         Value *cmp) {
-  IRBuilder<> Builder(S);
+  IRBuilder<> Builder(InsertPt);
 
   auto *I64Ty = Type::getInt64Ty(M->getContext());
   auto *I1Ty = Type::getInt1Ty(M->getContext());
 
   Constant *const_function =
-      M->getOrInsertFunction(function_name, FunctionType::getVoidTy(M->getContext()),
-                             I64Ty,   // store_id
-                             I64Ty,   // is_marked
-                             I64Ty);  // cmp
+      phoenix::get_or_insert_function(M, function_name, FunctionType::getVoidTy(M->getContext()),
+                                      I64Ty,   // store_id
+                                      I64Ty,   // is_marked
+                                      I64Ty);  // cmp
 
   Function *f = cast<Function>(const_function);
 
@@ -76,71 +68,75 @@ void Store::create_call(Module *M,
   CallInst *call = Builder.CreateCall(f, params);
 }
 
-void Store::track_store(Module *M, StoreInst *S, unsigned store_id, bool is_marked) {
-  IRBuilder<> Builder(S);
-
+Value *Store::is_silent(IRBuilder<> &Builder, StoreInst *S) {
   Value *ptr = S->getPointerOperand();
   Value *val = S->getValueOperand();
 
-  LoadInst *load = Builder.CreateLoad(ptr, "load");
+  LoadInst *load = Builder.CreateLoad(val->getType(), ptr, "load");
 
-  Value *cmp;
-  if (val->getType()->isFloatingPointTy()) {
-    cmp = Builder.CreateFCmpOEQ(val, load);
-  } else {
-    cmp = Builder.CreateICmpEQ(val, load);
-  }
+  // A vector store is silent when all of its lanes are
+  if (val->getType()->isFPOrFPVectorTy())
+    return phoenix::all_lanes(Builder, Builder.CreateFCmpOEQ(val, load));
+  return phoenix::all_lanes(Builder, Builder.CreateICmpEQ(val, load));
+}
+
+void Store::track_store(Module *M, StoreInst *S, unsigned store_id, bool is_marked) {
+  Instruction *InsertPt = phoenix::sample_before(S);
+  IRBuilder<> Builder(InsertPt);
+
+  Value *cmp = is_silent(Builder, S);
 
   Value *store_id_value = get_constantint(M, store_id);
   Value *is_marked_value = get_constantint(M, is_marked);
   Value *cmp_value = Builder.CreateZExt(cmp, Builder.getInt64Ty());
 
-  create_call(M, S, "record_store", store_id_value, is_marked_value, cmp_value);
+  create_call(M, InsertPt, "record_store", store_id_value, is_marked_value, cmp_value);
 }
 
-// Create a call to `dump_records` function
-void Store::insert_dump_call(Module *M, Instruction *I) {
-  IRBuilder<> Builder(I);
+// Same as `track_store` above, but increments the module counters inline
+void Store::track_store(StoreInst *S, unsigned store_id, phoenix::InlineCounters &counters) {
+  IRBuilder<> Builder(phoenix::sample_before(S));
+  counters.increment(Builder, store_id, is_silent(Builder, S));
+}
 
-  // Let's create the function call
-  Constant *const_function =
-      M->getOrInsertFunction("dump_records", FunctionType::getVoidTy(M->getContext()));
+// Creates a constructor that tells the runtime how many static stores this
+// module has. The runtime then allocates the counters once, instead of
+// growing them on the hot path of `record_store`
+void Store::insert_init_call(Module *M, unsigned num_stores) {
+  LLVMContext &Ctx = M->getContext();
+
+  Function *ctor = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                    GlobalValue::InternalLinkage, "phoenix.init_records", M);
+  BasicBlock *entry = BasicBlock::Create(Ctx, "entry", ctor);
+  IRBuilder<> Builder(entry);
+
+  Constant *const_function = phoenix::get_or_insert_function(
+      M, "init_records", FunctionType::getVoidTy(Ctx), Type::getInt32Ty(Ctx));  // num_stores
 
   Function *f = cast<Function>(const_function);
 
-  // Create the call
-  Builder.CreateCall(f, std::vector<Value *>());
-}
+  Builder.CreateCall(f, {Builder.getInt32(num_stores)});
+  Builder.CreateRetVoid();
 
-// Find the return inst and create call to `dump_records`
-void Store::insert_dump_call(Module *M) {
-  for (auto &F : *M) {
-    for (auto &BB : F) {
-      for (auto &I : BB) {
-        if (ReturnInst *ri = dyn_cast<ReturnInst>(&I)) {
-          if (F.getName() == "main")
-            insert_dump_call(M, ri);
-        } else if (CallInst *ci = dyn_cast<CallInst>(&I)) {
-          Function *fun = ci->getCalledFunction();
-          if (fun && fun->getName() == "exit") {
-            insert_dump_call(M, ci);
-          }
-        }
-      }
-    }
-  }
+  appendToGlobalCtors(*M, ctor, 0);
 }
 
 bool Store::runOnModule(Module &M) {
-  insert_dump_call(&M);
+  return runImpl(
+      M,
+      [this](Function &F) -> Identify & {
+        return getAnalysis<IdentifyWrapperPass>(F).getIdentify();
+      });
+}
 
+bool Store::runImpl(Module &M, function_ref<Identify &(Function &)> GetIdentify) {
   for (auto &F : M) {
     if (F.isDeclaration() || F.isIntrinsic() || F.hasAvailableExternallyLinkage())
       continue;
     
-    Identify *Idn = &getAnalysis<Identify>(F);
+    Identify *Idn = &GetIdentify(F);
 
-    llvm::SmallVector<Geps, 10> gs = Idn->get_instructions_of_interest();
+    llvm::SmallVector<Geps, 10> &gs = Idn->get_instructions_of_interest();
 
     // Let's give an id for each instruction of interest
     for (auto &g : gs) {
@@ -150,24 +146,86 @@ bool Store::runOnModule(Module &M) {
     }
   }
 
-  for (auto &F : M){
-    for (Instruction &I : instructions(F)){
-      if (StoreInst *S = dyn_cast<StoreInst>(&I)){
-        bool marked = (marked_stores.find(S) != marked_stores.end()) ? true : false;
-        unsigned store_id = get_id(S);
-        errs() << "Store[" << store_id << "]: " << *S << "\n"; 
-        track_store(&M, S, store_id, marked);
-      }
+  std::vector<StoreInst *> stores;
+  for (auto &F : M)
+    for (Instruction &I : instructions(F))
+      if (StoreInst *S = dyn_cast<StoreInst>(&I))
+        stores.push_back(S);
+
+  // Site hashes first, the instrumentation changes the ordinals. Ids are
+  // dense, they index the table of the runtime
+  for (unsigned store_id = 0; store_id < stores.size(); store_id++)
+    sites.add(store_id, stores[store_id]);
+  sites.write(M, phoenix::STORE_COUNTERS);
+
+  if (phoenix::UseInlineCounters) {
+    phoenix::InlineCounters counters(&M, phoenix::STORE_COUNTERS, stores.size());
+
+    for (unsigned store_id = 0; store_id < stores.size(); store_id++) {
+      StoreInst *S = stores[store_id];
+      bool marked = marked_stores.find(S) != marked_stores.end();
+      counters.set_info(store_id, marked);
+      track_store(S, store_id, counters);
     }
+
+    for (auto &F : M) {
+      if (F.isDeclaration())
+        continue;
+      // sample_before split blocks, the LoopInfo of the pass manager is stale
+      DominatorTree DT(F);
+      LoopInfo LI(DT);
+      phoenix::promote_counters(F, LI, counters.get_counters());
+    }
+
+    counters.finalize();
+    return false;
+  }
+
+  for (unsigned store_id = 0; store_id < stores.size(); store_id++) {
+    StoreInst *S = stores[store_id];
+    bool marked = marked_stores.find(S) != marked_stores.end();
+    track_store(&M, S, store_id, marked);
   }
 
+  insert_init_call(&M, stores.size());
+  phoenix::insert_sample_rate_ctor(M);
+
   return false;
 }
 
 void Store::getAnalysisUsage(AnalysisUsage &AU) const {
-  AU.addRequired<Identify>();
+  AU.addRequired<IdentifyWrapperPass>();
   AU.setPreservesAll();
 }
 
 char Store::ID = 0;
 static RegisterPass<Store> X("CountStores", "Count silent stores");
+
+PreservedAnalyses StorePass::run(Module &M, ModuleAnalysisManager &MAM) {
+  FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+  Store pass;
+  pass.runImpl(
+      M,
+      [&FAM](Function &F) -> Identify & { return FAM.getResult<IdentifyAnalysis>(F); });
+
+  return PreservedAnalyses::none();
+}
+
+#if LLVM_VERSION_MAJOR >= 14
+// opt -load CountStores.so -load-pass-plugin CountStores.so -passes=phoenix-count-stores
+// (-load registers the options of the plugin)
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "CountStores", LLVM_VERSION_STRING, [](PassBuilder &PB) {
+            register_identify(PB);
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, ModulePassManager &MPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "phoenix-count-stores")
+                    return false;
+                  MPM.addPass(StorePass());
+                  return true;
+                });
+          }};
+}
+#endif
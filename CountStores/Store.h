@@ -2,42 +2,51 @@
 
 using namespace llvm;
 
-#include <map>
 #include <set>
 
+#include "llvm/ADT/STLExtras.h"  // function_ref
 #include "../Identify/Geps.h"
 #include "../Identify/Identify.h"
+#include "../Identify/Lanes.h"
+#include "../Instrumentation/CounterPromotion.h"
+#include "../Instrumentation/InlineCounters.h"
+#include "../Instrumentation/Sampling.h"
+#include "../Instrumentation/SiteIds.h"
 
 
 class Store : public ModulePass {
  private:
-  std::map<StoreInst *, unsigned> mapa;
   std::set<StoreInst*> marked_stores;
-
-  unsigned get_id(StoreInst *S);
-  void assign_id(StoreInst *S);
-
-  void dump();
+  phoenix::SiteMap sites;
 
  public:
   // Pass identifier, for LLVM's RTTI support:
   static char ID;
 
   bool runOnModule(Module &);
+  // Shared with StorePass
+  bool runImpl(Module &M, function_ref<Identify &(Function &)> GetIdentify);
 
-  void insert_dump_call(Module *M, Instruction *I);
-  void insert_dump_call(Module *M);
+  void insert_init_call(Module *M, unsigned num_stores);
 
   void create_call(Module *M,
-                   StoreInst *S,
+                   Instruction *InsertPt,
                    const StringRef &function_name,
                    Value *store_id,
                    Value *is_marked,
                    Value *cmp);
+  // i1 true iff the store S is going to write the value already in memory
+  Value *is_silent(IRBuilder<> &Builder, StoreInst *S);
   void track_store(Module *M, StoreInst *S, unsigned store_id, bool is_marked);
+  void track_store(StoreInst *S, unsigned store_id, phoenix::InlineCounters &counters);
 
   void getAnalysisUsage(AnalysisUsage &AU) const;
 
   Store() : ModulePass(ID) {}
   ~Store() {}
 };
+
+// New pass manager
+struct StorePass : PassInfoMixin<StorePass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM);
+};
@@ -1,7 +1,8 @@
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Statistic.h"  // For the STATISTIC macro.
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemorySSA.h"
-#include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/Constants.h"          // For ConstantData, for instance.
@@ -10,28 +11,44 @@
 #include "llvm/IR/InstIterator.h"  // To use the iterator instructions(f)
 #include "llvm/IR/Instructions.h"  // To have access to the Instructions.
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/Passes/PassPlugin.h"
+#endif
 #include "llvm/Support/CommandLine.h"  // for command line opts
 #include "llvm/Support/Debug.h"        // To print error messages.
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"  // For dbgs()
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/LoopSimplify.h"
+#if LLVM_VERSION_MAJOR >= 7
+#include "llvm/Transforms/Utils.h"  // createLoopSimplifyPass
+#endif
 
 #include <queue>
 #include <tuple>
 
 #include "DAG.h"
 #include "ReachableNodes.h"
+#include "atomic.h"
+#include "cost_model.h"
 #include "intra_profile.h"
 #include "depthVisitor.h"
 #include "dotVisitor.h"
 #include "insertIf.h"
 #include "inter_profile.h"
 #include "propagateAnalysisVisitor.h"
+#include "reduction.h"
+#include "../Instrumentation/SiteHash.h"
+#include "../Support/Compat.h"
 
 #define DEBUG_TYPE "DAG"
 
@@ -40,6 +57,8 @@ enum OptType {
   IntraProfilling,
   InterProfilling,
   StoreElimination,
+  ProfileGuided,
+  Branchless,
 };
 
 cl::opt<OptType> DagInstrumentation(
@@ -49,25 +68,173 @@ cl::opt<OptType> DagInstrumentation(
     cl::values(clEnumValN(OptType::LoadElimination, "eae", "no profilling at all"),
                clEnumValN(OptType::IntraProfilling, "alp", "Inner loop profile"),
                clEnumValN(OptType::StoreElimination, "ess", "just check if the store is silent"),
-               clEnumValN(OptType::InterProfilling, "plp", "Outer loop profiler!")));
+               clEnumValN(OptType::InterProfilling, "plp", "Outer loop profiler!"),
+               clEnumValN(OptType::ProfileGuided, "pgo",
+                          "guard the stores that -phoenix-profile says are often silent"),
+               clEnumValN(OptType::Branchless, "branchless",
+                          "skip silent stores with llvm.masked.store instead of a branch")));
 
-// This should implement a cost model
-// Right now we only insert the `if` if the depth is >= threshold(1)
-// TO-DO: Use a more sophisticated solution
-bool DAG::worth_insert_if(Geps &g, unsigned loop_threshold = 1) {
-  if (g.get_loop_depth() >= loop_threshold)
+// Sites whose values are too random for a branch to be predicted well, e.g.
+// half silent with no pattern
+static cl::list<std::string> BranchlessSites(
+    "dag-branchless-sites",
+    cl::desc("Site hashes (from a store or arith site map) lowered as in -dag-opt=branchless"),
+    cl::CommaSeparated);
+
+// Off by default: the update of a register is cheap, so the cost model
+// rarely accepts the guard at the default -phoenix-identity-rate
+static cl::opt<bool> ReductionOpt(
+    "dag-reductions",
+    cl::desc("Also guard accumulators promoted to registers (reduction phis)"),
+    cl::init(false));
+
+// Extension points of the standard -O1/-O2/-O3 pipelines where the DAG can
+// run, see add_dag_passes
+enum EPType {
+  NoEP,
+  VectorizerStart,
+  ScalarOptimizerLate,
+  OptimizerLast,
+};
+
+static cl::opt<EPType> PhoenixEP(
+    "phoenix-ep",
+    cl::desc("Run the DAG at an extension point of the standard pipeline"),
+    cl::init(EPType::NoEP),
+    cl::values(clEnumValN(EPType::NoEP, "none", "only when requested (-DAG, -passes=phoenix-dag)"),
+               clEnumValN(EPType::VectorizerStart, "vectorizer-start", "before the loop vectorizer"),
+               clEnumValN(EPType::ScalarOptimizerLate, "scalar-late", "after the scalar optimizations"),
+               clEnumValN(EPType::OptimizerLast, "optimizer-last", "at the end of the pipeline")));
+
+// Given to the LTO driver that loaded DAG.so (e.g. llvm-lto2 -load), so the
+// DAG runs in the LTO backends, after the cross-module inlining
+static cl::opt<bool> PhoenixLTO(
+    "phoenix-lto",
+    cl::desc("Run the DAG at the end of the full LTO and ThinLTO backend pipelines"),
+    cl::init(false));
+
+static cl::opt<bool> AtomicOpt(
+    "dag-atomics",
+    cl::desc("Also guard atomicrmw whose operand may be the identity"),
+    cl::init(true));
+
+// The profilers decide at runtime, the other modes ask the cost model
+bool DAG::worth_insert_if(Geps &g, NodeSet &s) {
+  Value *v = g.get_instruction();
+
+  switch (DagInstrumentation) {
+    case OptType::InterProfilling:
+    case OptType::IntraProfilling:
+      return true;
+    case OptType::LoadElimination: {
+      // The outermost guard of load_elimination tests the cheapest node
+      auto nodes = phoenix::order_guards(g.get_store_inst(), s);
+      if (nodes.empty())
+        return false;
+      v = nodes.front()->getValue();
+      break;
+    }
+    case OptType::ProfileGuided:
+      return worth_profile_guard(g);
+    default:
+      break;
+  }
+
+  if (phoenix::worth_guard(g.get_store_inst(), v, phoenix::IdentityRate, *this->TTI))
+    return true;
+
+  LLVM_DEBUG(dbgs() << "skipping: " << *g.get_instruction() << "\n"
+               << " the guard costs more than it saves\n\n");
+  return false;
+}
+
+// `if (v != constant)` before @store pays off at the rate measured by @counts
+static bool worth_profile_guard(StoreInst *store, Value *v, std::pair<uint64_t, uint64_t> counts,
+                                TargetTransformInfo &TTI) {
+  double rate = (double)counts.first / counts.second;
+  if (rate < phoenix::ProfileThreshold) {
+    LLVM_DEBUG(dbgs() << "skipping: " << *v << "\n"
+                 << " identity rate " << rate << " is below the threshold\n\n");
+    return false;
+  }
+
+  // The cost model, at the measured rate
+  if (phoenix::worth_guard(store, v, rate, TTI))
     return true;
 
-  DEBUG(dbgs() << "skipping: " << *g.get_instruction() << "\n"
-               << " threshold " << g.get_loop_depth() << " is not greater than " << loop_threshold
-               << "\n\n");
+  LLVM_DEBUG(dbgs() << "skipping: " << *v << "\n"
+               << " the guard costs more than it saves\n\n");
+  return false;
+}
+
+// With an arith profile (CountArith), the guard tests v == identity before
+// the loads and the update, as the outermost guard of eae. With a store
+// profile (CountStores), it tests that the store is silent, as ess
+bool DAG::worth_profile_guard(Geps &g) {
+  StoreInst *store = g.get_store_inst();
+
+  // fmuladd(a, b, *p) has no v to test, a * b is only computed by the update
+  if (!g.is_fused())
+    if (auto counts = this->Profile->get_counts(g.get_instruction()))
+      if (::worth_profile_guard(store, g.get_v(), *counts, *this->TTI)) {
+        ProfileGuards[store] = {g.get_v(), Identify::get_identity(g), *counts};
+        return true;
+      }
+
+  if (auto counts = this->Profile->get_counts(store))
+    if (::worth_profile_guard(store, g.get_instruction(), *counts, *this->TTI)) {
+      ProfileGuards[store] = {g.get_instruction(), g.get_load_inst(), *counts};
+      return true;
+    }
+
+  LLVM_DEBUG(dbgs() << "skipping: " << *g.get_instruction() << "\n"
+               << " no profile guard\n\n");
+  return false;
+}
+
+// Only the updates in a hot block, and only if the cost model says so
+bool DAG::worth_guard(Reduction &r) {
+  llvm::SmallVector<Instruction *, 2> skipped;
+  Value *guard = phoenix::get_guard(r, skipped);
+
+  if (!phoenix::is_hot(r.get_instruction()->getParent(), *this->BFI)) {
+    LLVM_DEBUG(dbgs() << "skipping: " << *r.get_instruction() << "\n"
+                 << " does not run more often than the function entry\n\n");
+    return false;
+  }
+
+  if (phoenix::worth_guard(skipped, guard, phoenix::IdentityRate, *this->TTI))
+    return true;
+
+  LLVM_DEBUG(dbgs() << "skipping: " << *r.get_instruction() << "\n"
+               << " the guard costs more than it saves\n\n");
+  return false;
+}
+
+bool DAG::worth_guard(AtomicRMWInst *RMW) {
+  // The load that replaces it costs no more, see atomic_elimination
+  if (RMW->getValOperand() == Identify::get_identity(RMW))
+    return true;
+
+  if (!phoenix::is_hot(RMW->getParent(), *this->BFI)) {
+    LLVM_DEBUG(dbgs() << "skipping: " << *RMW << "\n"
+                 << " does not run more often than the function entry\n\n");
+    return false;
+  }
+
+  Instruction *skipped[] = {RMW};
+  if (phoenix::worth_guard(skipped, RMW->getValOperand(), phoenix::IdentityRate, *this->TTI))
+    return true;
+
+  LLVM_DEBUG(dbgs() << "skipping: " << *RMW << "\n"
+               << " the guard costs more than it saves\n\n");
   return false;
 }
 
 void DAG::update_passes(BasicBlock *from, BasicBlock *to) {
   // update LoopInfo
-  Loop *L = this->LI->getLoopFor(from);
-  L->addBasicBlockToLoop(to, *this->LI);
+  if (Loop *L = this->LI->getLoopFor(from))
+    L->addBasicBlockToLoop(to, *this->LI);
 
   this->DT->insertEdge(from, to);
   
@@ -101,24 +268,56 @@ void DAG::split(BasicBlock *from) {
   }
 }
 
+static bool is_branchless_site(phoenix::SiteHasher &sites, Instruction *I) {
+  if (BranchlessSites.empty())
+    return false;
+
+  std::string hash = utohexstr(sites.get_site_hash(I), true);
+  return any_of(BranchlessSites, [&hash](const std::string &site) {
+    return StringRef(site).ltrim('0').lower() == hash;
+  });
+}
+
 //
 void DAG::run_dag_opt(Function &F) {
-  auto geps = this->Idtf->get_instructions_of_interest();
+  auto &geps = this->Idtf->get_instructions_of_interest();
 
   if (geps.size() == 0)
     return;
 
   std::vector<ReachableNodes> reachables;
+  std::vector<ReachableNodes> branchless;
+  ProfileGuards.clear();
 
-  for (auto &g : geps) {
-    Instruction *I = g.get_instruction();
+  // BlockFrequencyInfo does not know the blocks created by split. With a
+  // profile, the measured counts are used instead
+  std::vector<bool> hot;
+  for (auto &g : geps)
+    hot.push_back(DagInstrumentation == OptType::ProfileGuided ||
+                  phoenix::is_hot(g.get_store_inst()->getParent(), *this->BFI));
 
-    // sanity check for vector instructions
-    if (I->getOperand(0)->getType()->isVectorTy() || I->getOperand(1)->getType()->isVectorTy()) {
+  // Before split, which moves the instructions the site hashes depend on
+  std::vector<bool> is_branchless;
+  phoenix::SiteHasher sites;
+  for (auto &g : geps)
+    is_branchless.push_back(DagInstrumentation == OptType::Branchless ||
+                            is_branchless_site(sites, g.get_store_inst()) ||
+                            is_branchless_site(sites, g.get_instruction()));
+
+  for (unsigned i = 0; i < geps.size(); i++) {
+    Geps &g = geps[i];
+    bool to_branchless = is_branchless[i] && DagInstrumentation != OptType::IntraProfilling &&
+                         DagInstrumentation != OptType::InterProfilling;
+
+    if (!hot[i]) {
+      LLVM_DEBUG(dbgs() << "skipping: " << *g.get_instruction() << "\n"
+                   << " does not run more often than the function entry\n\n");
       continue;
     }
 
-    if (!worth_insert_if(g))
+    // The profilers clone the basic block of the store
+    if (!g.is_local() && (DagInstrumentation == OptType::IntraProfilling ||
+                          DagInstrumentation == OptType::InterProfilling))
       continue;
 
     // Split the basic block after each store instruction
@@ -133,6 +332,17 @@ void DAG::run_dag_opt(Function &F) {
 
     NodeSet s = dv.getSet();
 
+    // Without a branch, nothing is skipped: the expression is computed anyway
+    // and the masked store only saves the write
+    if (to_branchless) {
+      branchless.push_back(
+          ReachableNodes(g.get_store_inst(), g.get_load_inst(), g.get_instruction(), s));
+      continue;
+    }
+
+    if (!worth_insert_if(g, s))
+      continue;
+
     // DotVisitor dot(store);
     // dot.print();
 
@@ -148,23 +358,85 @@ void DAG::run_dag_opt(Function &F) {
       phoenix::intra_profilling(&F, reachables);
       break;
     case OptType::LoadElimination:
-      phoenix::load_elimination(&F, reachables);
+      phoenix::load_elimination(&F, reachables, *this->TTI);
+      break;
+    case OptType::ProfileGuided:
+      for (ReachableNodes &rn : reachables) {
+        const ProfileGuard &guard = ProfileGuards[rn.get_store()];
+        phoenix::insert_if(rn.get_store(), guard.v, guard.constant,
+                           phoenix::get_branch_weights(F.getContext(), guard.counts.first,
+                                                       guard.counts.second));
+      }
       break;
     default:
       phoenix::silent_store_elimination(&F, reachables);
   }
+
+  phoenix::branchless_elimination(branchless, DagInstrumentation == OptType::LoadElimination,
+                                  *this->TTI);
+}
+
+static bool skip(Function &F) {
+  return F.isDeclaration() || F.isIntrinsic() || F.hasPrivateLinkage() ||
+         F.hasAvailableExternallyLinkage();
 }
 
 //
 bool DAG::runOnFunction(Function &F) {
-  if (F.isDeclaration() || F.isIntrinsic() || F.hasPrivateLinkage() || F.hasAvailableExternallyLinkage())
+  if (skip(F))
     return false;
 
-  Idtf = &getAnalysis<Identify>();
-  LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
-  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  return runImpl(F,
+                 getAnalysis<IdentifyWrapperPass>().getIdentify(),
+                 getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+                 getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+                 getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F),
+                 getAnalysis<BlockFrequencyInfoWrapperPass>().getBFI(),
+                 StoreCounts);
+}
+
+bool DAG::runImpl(Function &F, Identify &Idtf, LoopInfo &LI, DominatorTree &DT,
+                  TargetTransformInfo &TTI, BlockFrequencyInfo &BFI,
+                  phoenix::StoreProfile &Profile) {
+  this->Idtf = &Idtf;
+  this->LI = &LI;
+  this->DT = &DT;
+  this->TTI = &TTI;
+  this->BFI = &BFI;
+  this->Profile = &Profile;
+
+  if (DagInstrumentation == OptType::ProfileGuided)
+    Profile.load(phoenix::ProfileFile, F);
+
+  // The profilers only know about *p = *p `op` v. Chosen before run_dag_opt
+  // splits blocks that BlockFrequencyInfo does not know about
+  bool guard_updates = DagInstrumentation == OptType::StoreElimination ||
+                       DagInstrumentation == OptType::LoadElimination;
+
+  llvm::SmallVector<Reduction, 10> reductions;
+  if (ReductionOpt && guard_updates)
+    for (Reduction &r : Idtf.get_reductions())
+      if (worth_guard(r))
+        reductions.push_back(r);
+
+  llvm::SmallVector<AtomicRMWInst *, 10> atomics;
+  if (AtomicOpt && guard_updates)
+    for (AtomicRMWInst *RMW : Idtf.get_atomics())
+      if (worth_guard(RMW))
+        atomics.push_back(RMW);
+
   run_dag_opt(F);
 
+  // insert_if and insert_branchless split blocks without updating them
+  if (!reductions.empty() || !atomics.empty()) {
+    this->DT->recalculate(F);
+    this->LI->releaseMemory();
+    this->LI->analyze(*this->DT);
+  }
+
+  phoenix::reduction_elimination(&F, reductions, this->DT, this->LI);
+  phoenix::atomic_elimination(&F, atomics, this->DT, this->LI);
+
   return true;
 }
 
@@ -172,9 +444,110 @@ bool DAG::runOnFunction(Function &F) {
 void DAG::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<LoopInfoWrapperPass>();
   AU.addRequired<DominatorTreeWrapperPass>();
-  AU.addRequired<PostDominatorTreeWrapperPass>();
-  AU.addRequired<Identify>();
+  AU.addRequired<TargetTransformInfoWrapperPass>();
+  AU.addRequired<BlockFrequencyInfoWrapperPass>();
+  AU.addRequired<IdentifyWrapperPass>();
 }
 
 char DAG::ID = 0;
 static RegisterPass<DAG> X("DAG", "DAG pattern a = a OP b", false, false);
+
+PreservedAnalyses DAGPass::run(Function &F, FunctionAnalysisManager &FAM) {
+  DAG dag;
+  if (skip(F) || !dag.runImpl(F,
+                   FAM.getResult<IdentifyAnalysis>(F),
+                   FAM.getResult<LoopAnalysis>(F),
+                   FAM.getResult<DominatorTreeAnalysis>(F),
+                   FAM.getResult<TargetIRAnalysis>(F),
+                   FAM.getResult<BlockFrequencyAnalysis>(F),
+                   Profile))
+    return PreservedAnalyses::all();
+
+  // insert_if splits blocks without updating LoopInfo or the DominatorTree
+  return PreservedAnalyses::none();
+}
+
+// Identify expects redundant loads and geps to be merged (early-cse) and loops
+// in simplified form, the pipeline does not guarantee either at the
+// extension points
+static void add_dag_passes(legacy::PassManagerBase &PM) {
+  PM.add(createEarlyCSEPass());
+  PM.add(createLoopSimplifyPass());
+  PM.add(new DAG());
+}
+
+static void add_dag_passes(FunctionPassManager &FPM) {
+  FPM.addPass(EarlyCSEPass());
+  FPM.addPass(LoopSimplifyPass());
+  FPM.addPass(DAGPass());
+}
+
+// clang -Xclang -load -Xclang DAG.so -mllvm -phoenix-ep=<point>
+static RegisterStandardPasses VectorizerStartEP(
+    PassManagerBuilder::EP_VectorizerStart,
+    [](const PassManagerBuilder &, legacy::PassManagerBase &PM) {
+      if (PhoenixEP == EPType::VectorizerStart)
+        add_dag_passes(PM);
+    });
+
+static RegisterStandardPasses ScalarOptimizerLateEP(
+    PassManagerBuilder::EP_ScalarOptimizerLate,
+    [](const PassManagerBuilder &, legacy::PassManagerBase &PM) {
+      if (PhoenixEP == EPType::ScalarOptimizerLate)
+        add_dag_passes(PM);
+    });
+
+// The ThinLTO backends run the -O2/-O3 pipeline again, with PerformThinLTO
+static RegisterStandardPasses OptimizerLastEP(
+    PassManagerBuilder::EP_OptimizerLast,
+    [](const PassManagerBuilder &Builder, legacy::PassManagerBase &PM) {
+      if (PhoenixEP == EPType::OptimizerLast || (PhoenixLTO && Builder.PerformThinLTO))
+        add_dag_passes(PM);
+    });
+
+static RegisterStandardPasses FullLTOLastEP(
+    PassManagerBuilder::EP_FullLinkTimeOptimizationLast,
+    [](const PassManagerBuilder &, legacy::PassManagerBase &PM) {
+      if (PhoenixLTO)
+        add_dag_passes(PM);
+    });
+
+#if LLVM_VERSION_MAJOR >= 14
+using OptLevel = OptimizationLevel;
+
+// opt -load DAG.so -load-pass-plugin DAG.so -passes=phoenix-dag, or
+// -passes='default<O3>' -phoenix-ep=<point>
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "DAG", LLVM_VERSION_STRING, [](PassBuilder &PB) {
+            register_identify(PB);
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                   ArrayRef<PassBuilder::PipelineElement>) {
+                  if (Name != "phoenix-dag")
+                    return false;
+                  FPM.addPass(DAGPass());
+                  return true;
+                });
+
+            PB.registerVectorizerStartEPCallback(
+                [](FunctionPassManager &FPM, OptLevel) {
+                  if (PhoenixEP == EPType::VectorizerStart)
+                    add_dag_passes(FPM);
+                });
+            PB.registerScalarOptimizerLateEPCallback(
+                [](FunctionPassManager &FPM, OptLevel) {
+                  if (PhoenixEP == EPType::ScalarOptimizerLate)
+                    add_dag_passes(FPM);
+                });
+            // Also the end of the ThinLTO backend pipeline
+            PB.registerOptimizerLastEPCallback(
+                [](ModulePassManager &MPM, OptLevel) {
+                  if (PhoenixEP != EPType::OptimizerLast && !PhoenixLTO)
+                    return;
+                  FunctionPassManager FPM;
+                  add_dag_passes(FPM);
+                  MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+                });
+          }};
+}
+#endif
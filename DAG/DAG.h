@@ -4,25 +4,44 @@ using namespace llvm;
 
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "../Identify/Geps.h"
 #include "../Identify/Identify.h"
 #include "../ProgramSlicing/ProgramSlicing.h"
 #include "node.h"
 #include "NodeSet.h"
 #include "parser.h"
+#include "profile.h"
 
 class DAG : public FunctionPass {
  private:
-  unsigned loop_threshold = 1;
-  //
   LoopInfo *LI;
   DominatorTree *DT;
   Identify *Idtf;
+  TargetTransformInfo *TTI;
+  BlockFrequencyInfo *BFI;
+  phoenix::StoreProfile *Profile;
+
+  // -dag-opt=pgo, kept between functions of the same module
+  phoenix::StoreProfile StoreCounts;
+
+  // The guard -dag-opt=pgo puts before each store, `if (v != constant)`,
+  // and the {hits, total} of its branch weights
+  struct ProfileGuard {
+    Value *v;
+    Value *constant;
+    std::pair<uint64_t, uint64_t> counts;
+  };
+  DenseMap<const StoreInst *, ProfileGuard> ProfileGuards;
   //
  
  private:
 
-  bool worth_insert_if(Geps &g, unsigned loop_threshold);
+  bool worth_insert_if(Geps &g, NodeSet &s);
+  bool worth_profile_guard(Geps &g);
+  bool worth_guard(Reduction &r);
+  bool worth_guard(AtomicRMWInst *RMW);
   void run_dag_opt(Function &F);
 
   void split(StoreInst *store);
@@ -35,6 +54,9 @@ class DAG : public FunctionPass {
   static char ID;
 
   bool runOnFunction(Function &);
+  // Shared with DAGPass
+  bool runImpl(Function &F, Identify &Idtf, LoopInfo &LI, DominatorTree &DT,
+               TargetTransformInfo &TTI, BlockFrequencyInfo &BFI, phoenix::StoreProfile &Profile);
 
   void getAnalysisUsage(AnalysisUsage &AU) const;
 
@@ -42,3 +64,10 @@ class DAG : public FunctionPass {
   ~DAG() {}
 
 };
+
+// New pass manager
+struct DAGPass : PassInfoMixin<DAGPass> {
+  phoenix::StoreProfile Profile;
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM);
+};
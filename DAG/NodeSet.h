@@ -3,8 +3,9 @@
 #include "node.h"
 
 struct NodeCompare {
+  // Nodes of different basic blocks may be at the same distance
   bool operator() (const phoenix::Node *a, const phoenix::Node *b) const {
-    return a->distance() < b->distance();
+    return std::make_pair(a->distance(), a->getID()) < std::make_pair(b->distance(), b->getID());
   }
 };
 
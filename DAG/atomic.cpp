@@ -0,0 +1,91 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "../Identify/Identify.h"
+#include "atomic.h"
+#include "../Support/Compat.h"
+
+#define DEBUG_TYPE "DAG"
+
+using namespace llvm;
+
+namespace phoenix {
+
+// The identity does not change memory, so the atomicrmw can be replaced by a
+// load of the same ordering. Identify only keeps monotonic and acquire ones
+static Value *create_load(IRBuilder<> &Builder, AtomicRMWInst *RMW) {
+  const DataLayout &DL = RMW->getModule()->getDataLayout();
+  LoadInst *load = Builder.CreateLoad(RMW->getType(), RMW->getPointerOperand(), "phoenix.atomic");
+  set_alignment(load, DL.getTypeStoreSize(RMW->getType()));
+  load->setAtomic(RMW->getOrdering(), RMW->getSyncScopeID());
+  return load;
+}
+
+static void guard_atomic(AtomicRMWInst *RMW, DominatorTree *DT, LoopInfo *LI) {
+  Value *val = RMW->getValOperand();
+  Constant *identity = Identify::get_identity(RMW);
+
+  // Always a no-op: no guard, just the load
+  if (val == identity) {
+    LLVM_DEBUG(dbgs() << "[" << RMW->getFunction()->getName() << "]: "
+                 << "replacing atomic: " << *RMW << "\n");
+
+    IRBuilder<> Builder(RMW);
+    RMW->replaceAllUsesWith(create_load(Builder, RMW));
+    RMW->eraseFromParent();
+    return;
+  }
+
+  LLVM_DEBUG(dbgs() << "[" << RMW->getFunction()->getName() << "]: "
+               << "guarding atomic: " << *RMW << "\n");
+
+  IRBuilder<> Builder(RMW);
+  Value *cmp = Builder.CreateICmpEQ(val, identity);
+
+  Instruction *ThenTerm, *ElseTerm;
+  llvm::SplitBlockAndInsertIfThenElse(cmp, RMW, &ThenTerm, &ElseTerm);
+
+  BasicBlock *BBThen = ThenTerm->getParent();
+  BasicBlock *BBElse = ElseTerm->getParent();
+  BasicBlock *BBEnd = ThenTerm->getSuccessor(0);
+
+  // Update the loop of the new blocks, as SplitBlockAndInsertIfThen does
+  if (Loop *L = LI->getLoopFor(BBThen->getSinglePredecessor())) {
+    L->addBasicBlockToLoop(BBThen, *LI);
+    L->addBasicBlockToLoop(BBElse, *LI);
+    L->addBasicBlockToLoop(BBEnd, *LI);
+  }
+
+  Builder.SetInsertPoint(ThenTerm);
+  Value *load = create_load(Builder, RMW);
+
+  RMW->moveBefore(ElseTerm);
+
+  llvm::SmallVector<User *, 8> users(RMW->user_begin(), RMW->user_end());
+  if (users.empty())
+    return;
+
+  PHINode *old = PHINode::Create(RMW->getType(), 2, "phoenix.old", &BBEnd->front());
+  for (User *U : users)
+    U->replaceUsesOfWith(RMW, old);
+
+  old->addIncoming(load, BBThen);
+  old->addIncoming(RMW, BBElse);
+}
+
+void atomic_elimination(Function *F, llvm::SmallVector<AtomicRMWInst *, 10> &atomics,
+                        DominatorTree *DT, LoopInfo *LI) {
+  for (AtomicRMWInst *RMW : atomics)
+    guard_atomic(RMW, DT, LI);
+
+  // SplitBlockAndInsertIfThenElse does not keep the dominator tree
+  if (!atomics.empty())
+    DT->recalculate(*F);
+}
+
+};  // end namespace phoenix
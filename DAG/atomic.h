@@ -0,0 +1,20 @@
+#pragma once
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+// Guards each atomicrmw whose operand may be the identity (add 0, or 0,
+// and -1, max INT_MIN, ...) with
+//   old = (val == identity) ? load atomic *p : atomicrmw op *p, val
+// so that a no-op update does not take the cache line exclusive. An operand
+// that is the identity constant needs no guard: the load replaces the RMW
+void atomic_elimination(Function *F, llvm::SmallVector<AtomicRMWInst *, 10> &atomics,
+                        DominatorTree *DT, LoopInfo *LI);
+
+};  // end namespace phoenix
@@ -0,0 +1,110 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "cost_model.h"
+#include "insertIf.h"
+#include "../Support/Compat.h"
+
+#define DEBUG_TYPE "DAG"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<double> IdentityRate(
+    "phoenix-identity-rate",
+    cl::desc("Expected fraction of the executions where the guarded value is the identity"),
+    cl::init(0.5));
+
+// TTI only counts instructions. A store that writes memory also dirties a
+// cache line (and invalidates it in the other cores), which is what silent
+// store elimination saves in the first place
+static cl::opt<unsigned> StoreSavings(
+    "phoenix-store-savings",
+    cl::desc("Cost of dirtying a cache line, added to the cost of each skipped store"),
+    cl::init(4));
+
+bool is_hot(BasicBlock *BB, BlockFrequencyInfo &BFI) {
+  return BFI.getBlockFreq(BB).getFrequency() > BFI.getEntryFreq();
+}
+
+static unsigned get_cost(Instruction *I, TargetTransformInfo &TTI) {
+  int cost = get_instruction_cost(TTI, I);
+  // -1 when the target does not know
+  return cost < 0 ? 0 : cost;
+}
+
+// @v and everything it is computed from: the guard needs them anyway
+static SmallPtrSet<Instruction *, 16> get_needed(Value *v) {
+  SmallPtrSet<Instruction *, 16> needed;
+  SmallVector<Instruction *, 16> worklist;
+
+  if (Instruction *I = dyn_cast<Instruction>(v))
+    worklist.push_back(I);
+
+  while (!worklist.empty()) {
+    Instruction *I = worklist.pop_back_val();
+    if (!needed.insert(I).second || isa<PHINode>(I))
+      continue;
+    for (Value *op : I->operands())
+      if (Instruction *inst = dyn_cast<Instruction>(op))
+        worklist.push_back(inst);
+  }
+
+  return needed;
+}
+
+static unsigned skipped_cost(ArrayRef<Instruction *> skipped, TargetTransformInfo &TTI) {
+  unsigned cost = 0;
+  bool writes = false;
+
+  for (Instruction *I : skipped) {
+    cost += get_cost(I, TTI);
+    writes |= I->mayWriteToMemory();
+  }
+
+  return writes ? cost + StoreSavings : cost;
+}
+
+static unsigned guard_cost(Value *v, TargetTransformInfo &TTI) {
+  Type *Ty = v->getType();
+  unsigned opcode = Ty->isFPOrFPVectorTy() ? Instruction::FCmp : Instruction::ICmp;
+
+  unsigned cost =
+      get_cmp_cost(TTI, opcode, Ty) + get_cost_value(TTI.getCFInstrCost(Instruction::Br));
+
+  // All lanes must hold the identity (see insert_if)
+  if (Ty->isVectorTy()) {
+    VectorType *CmpTy =
+        get_vector_type(Type::getInt1Ty(Ty->getContext()), get_vector_num_elements(Ty));
+    cost += get_and_reduction_cost(TTI, CmpTy);
+  }
+
+  return cost;
+}
+
+bool worth_guard(ArrayRef<Instruction *> skipped, Value *v, double rate,
+                 TargetTransformInfo &TTI) {
+  unsigned saved = skipped_cost(skipped, TTI);
+  unsigned guard = guard_cost(v, TTI);
+
+  LLVM_DEBUG(dbgs() << "cost model: " << *v << "\n"
+               << " skipped " << saved << " * rate " << rate << " vs guard " << guard << "\n");
+
+  return rate * saved > guard;
+}
+
+bool worth_guard(StoreInst *store, Value *v, double rate, TargetTransformInfo &TTI) {
+  SmallPtrSet<Instruction *, 16> needed = get_needed(v);
+  llvm::SmallVector<Instruction *, 10> skipped;
+
+  for (Instruction *I : mark_instructions_to_be_moved(store))
+    if (!needed.count(I))
+      skipped.push_back(I);
+
+  return worth_guard(skipped, v, rate, TTI);
+}
+
+};  // end namespace phoenix
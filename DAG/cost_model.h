@@ -0,0 +1,30 @@
+#pragma once
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+extern cl::opt<double> IdentityRate;
+
+// True if @BB runs more often than the entry of its function, i.e. it is in
+// a loop that is expected to iterate
+bool is_hot(BasicBlock *BB, BlockFrequencyInfo &BFI);
+
+// A guard `if (@v != identity)` before @store skips the store and the part
+// of the expression that only the store uses (see
+// mark_instructions_to_be_moved). It pays off when
+//   @rate * cost(skipped) > cost(compare) + cost(branch)
+bool worth_guard(StoreInst *store, Value *v, double rate, TargetTransformInfo &TTI);
+
+// Same, for a guard that skips exactly the instructions in @skipped (the
+// update of a reduction, an atomicrmw)
+bool worth_guard(ArrayRef<Instruction *> skipped, Value *v, double rate,
+                 TargetTransformInfo &TTI);
+
+};  // end namespace phoenix
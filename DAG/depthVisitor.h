@@ -59,6 +59,15 @@ class DepthVisitor : public Visitor {
 
   }
 
+  // Only a or b can be compared: the value of the node is a * b + c
+  void visit(phoenix::FusedMulNode *fused) override {
+    if (!fused->hasConstant())
+      return;
+
+    fused->left->accept(*this);
+    fused->right->accept(*this);
+  }
+
   void visit(phoenix::TargetOpNode *target) override {
     if (target->getOther()->hasConstant()){
       target->getOther()->accept(*this);
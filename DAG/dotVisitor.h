@@ -85,6 +85,10 @@ class DotVisitor : public Visitor {
         return "&";
       case Instruction::Or:
         return "|";
+      case Instruction::Call:
+        if (is_fused_mul_add(I))
+          return "+.";
+        return I->getOpcodeName();
       default:
         return I->getOpcodeName();
         // std::string str = "Symbol not found: ";
@@ -174,6 +178,21 @@ class DotVisitor : public Visitor {
     other->accept(*this);
   }
 
+  void visit(phoenix::FusedMulNode *fused) override {
+    phoenix::Node *left = fused->left, *right = fused->right;
+
+    std::string idA = ID(fused);
+    std::string idB = ID(left);
+    std::string idC = ID(right);
+
+    str += NODE(idA, fused->instType() + " = " + ENDL + "*.", COLOR(fused)) + "\n";
+    str += EDGE(idA, idB, fused->label(), COLOR(fused)) + "\n";
+    str += EDGE(idA, idC, fused->label(), COLOR(fused)) + "\n";
+
+    left->accept(*this);
+    right->accept(*this);
+  }
+
   void visit(phoenix::TerminalNode *t) override {
     std::string labelA = ID(t);
     str += NODE(labelA, t->name(), COLOR(t)) + "\n";
@@ -1,3 +1,4 @@
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"  // For the STATISTIC macro.
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/MemorySSA.h"
@@ -13,6 +14,7 @@
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"  // To print error messages.
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -24,8 +26,11 @@
 #include <algorithm>    // std::reverse
 
 #include "../Identify/Geps.h"
+#include "../Identify/Lanes.h"
+#include "../Support/Compat.h"
 #include "NodeSet.h"
 #include "ReachableNodes.h"
+#include "cost_model.h"
 #include "insertIf.h"
 #include "utils.h"
 
@@ -33,6 +38,11 @@
 
 using namespace llvm;
 
+static cl::opt<bool> MaskedStore(
+    "dag-masked-store",
+    cl::desc("Turn silent vector stores into llvm.masked.store of the lanes that change"),
+    cl::init(false));
+
 namespace phoenix {
 
 llvm::SmallVector<Instruction *, 10> mark_instructions_to_be_moved(StoreInst *store) {
@@ -52,17 +62,17 @@ llvm::SmallVector<Instruction *, 10> mark_instructions_to_be_moved(StoreInst *st
     q.pop();
 
     std::for_each(marked.begin(), marked.end(),
-                  [](Value *v) { DEBUG(errs() << "mark: " << *v << "\n"); });
+                  [](Value *v) { LLVM_DEBUG(errs() << "mark: " << *v << "\n"); });
 
     // Check if *v is only used in instructions already marked
-    bool all_marked = std::all_of(begin(v->users()), end(v->users()), [&v, &marked](Value *user) {
+    bool all_marked = std::all_of(v->user_begin(), v->user_end(), [&v, &marked](Value *user) {
       if (cast<Instruction>(user)->getParent() != v->getParent())
         return false;
       return find(marked, user) != marked.end();
     });
 
     if (!all_marked) {
-      DEBUG(dbgs() << "-> Ignoring: " << *v << "\n");
+      LLVM_DEBUG(dbgs() << "-> Ignoring: " << *v << "\n");
       continue;
     }
 
@@ -74,7 +84,7 @@ llvm::SmallVector<Instruction *, 10> mark_instructions_to_be_moved(StoreInst *st
         if (Instruction *inst = dyn_cast<Instruction>(op)) {
           // restrict ourselves to instructions on the same basic block
           if (v->getParent() != inst->getParent()) {
-            DEBUG(dbgs() << "-> not in the same BB: " << *inst << "\n");
+            LLVM_DEBUG(dbgs() << "-> not in the same BB: " << *inst << "\n");
             continue;
           }
 
@@ -105,7 +115,7 @@ void move_from_prev_to_then(BasicBlock *BBPrev, BasicBlock *BBThen) {
     if (isa<PHINode>(I) || isa<BranchInst>(I))
       continue;
 
-    if (begin(I->users()) == end(I->users()))
+    if (I->user_empty())
       continue;
 
     // Move I from BBPrev to BBThen iff all users of I are in BBThen
@@ -117,20 +127,20 @@ void move_from_prev_to_then(BasicBlock *BBPrev, BasicBlock *BBThen) {
     //  gives us the guarantee that all users of I living in the same BB were
     //  previously visited.
 
-    bool can_move_I = std::all_of(begin(I->users()), end(I->users()), [&BBThen](User *U) {
+    bool can_move_I = std::all_of(I->user_begin(), I->user_end(), [&BBThen](User *U) {
       BasicBlock *parent = dyn_cast<Instruction>(U)->getParent();
       return (parent == BBThen);
     });
 
     if (can_move_I) {
-      DEBUG(dbgs() << "[BBPrev -> BBThen] " << *I << "\n");
+      LLVM_DEBUG(dbgs() << "[BBPrev -> BBThen] " << *I << "\n");
       --b;
       I->moveBefore(BBThen->getFirstNonPHI());
     }
   }
 }
 
-void insert_if(StoreInst *store, Value *v, Value *constant) {
+void insert_if(StoreInst *store, Value *v, Value *constant, MDNode *weights) {
   IRBuilder<> Builder(store);
 
   Value *cmp;
@@ -138,14 +148,19 @@ void insert_if(StoreInst *store, Value *v, Value *constant) {
   errs() << "[" << store->getFunction()->getName() << "]: "
          << "inserting if on: " << *v << " with constant: " << *constant << "\n";
 
-  if (v->getType()->isFloatingPointTy()) {
+  if (v->getType()->isVectorTy()) {
+    // Skip the whole vector iteration only if every lane holds the constant
+    Value *eq = v->getType()->isFPOrFPVectorTy() ? Builder.CreateFCmpOEQ(v, constant)
+                                                 : Builder.CreateICmpEQ(v, constant);
+    cmp = Builder.CreateNot(all_lanes(Builder, eq));
+  } else if (v->getType()->isFloatingPointTy()) {
     cmp = Builder.CreateFCmpONE(v, constant);
   } else {
     cmp = Builder.CreateICmpNE(v, constant);
   }
 
-  TerminatorInst *br =
-      llvm::SplitBlockAndInsertIfThen(cmp, dyn_cast<Instruction>(cmp)->getNextNode(), false);
+  Instruction *br =
+      llvm::SplitBlockAndInsertIfThen(cmp, dyn_cast<Instruction>(cmp)->getNextNode(), false, weights);
 
   BasicBlock *BBThen = br->getParent();
   BasicBlock *BBPrev = BBThen->getSinglePredecessor();
@@ -157,7 +172,7 @@ void insert_if(StoreInst *store, Value *v, Value *constant) {
 
   llvm::SmallVector<Instruction *, 10> marked = mark_instructions_to_be_moved(store);
 
-  for_each(marked, [](Instruction *inst) { DEBUG(dbgs() << " Marked: " << *inst << "\n"); });
+  for_each(marked, [](Instruction *inst) { LLVM_DEBUG(dbgs() << " Marked: " << *inst << "\n"); });
 
   move_marked_to_basic_block(marked, br);
 
@@ -166,6 +181,71 @@ void insert_if(StoreInst *store, Value *v, Value *constant) {
   // add_dump_msg(BBEnd, "BBEnd\n");
 }
 
+// The alignment of @store, 0 stands for the ABI one of its type
+static unsigned get_alignment(StoreInst *store) {
+  if (store->getAlignment())
+    return store->getAlignment();
+  const DataLayout &DL = store->getModule()->getDataLayout();
+  return DL.getABITypeAlignment(store->getValueOperand()->getType());
+}
+
+// Only writes the lanes of @store that differ from @load
+void insert_masked_store(StoreInst *store, Value *load) {
+  IRBuilder<> Builder(store);
+  Value *v = store->getValueOperand();
+
+  Value *mask = v->getType()->isFPOrFPVectorTy() ? Builder.CreateFCmpUNE(v, load)
+                                                 : Builder.CreateICmpNE(v, load);
+  create_masked_store(Builder, v, store->getPointerOperand(), get_alignment(store), mask);
+
+  LLVM_DEBUG(dbgs() << "[" << store->getFunction()->getName() << "]: "
+               << "masked store: " << *store << "\n");
+  store->eraseFromParent();
+}
+
+// Lane-wise @v != @old. NaN compares unequal, so it is always written
+static Value *create_changed(IRBuilder<> &Builder, Value *v, Value *old) {
+  return v->getType()->isFPOrFPVectorTy() ? Builder.CreateFCmpUNE(v, old)
+                                          : Builder.CreateICmpNE(v, old);
+}
+
+bool insert_branchless(StoreInst *store, Value *changed, TargetTransformInfo &TTI) {
+  Value *v = store->getValueOperand();
+  Type *Ty = v->getType();
+  unsigned align = get_alignment(store);
+  IRBuilder<> Builder(store);
+
+  if (Ty->isVectorTy() && is_legal_masked_store(TTI, Ty, align)) {
+    create_masked_store(Builder, v, store->getPointerOperand(), align, changed);
+    LLVM_DEBUG(dbgs() << "[" << store->getFunction()->getName() << "]: "
+                 << "masked store: " << *store << "\n");
+    store->eraseFromParent();
+    return true;
+  }
+
+  // The address is a select: a silent store goes to a slot on the stack, so
+  // the cache line of *p is not dirtied
+  Function *F = store->getFunction();
+  const DataLayout &DL = F->getParent()->getDataLayout();
+  if (!store->isSimple() || store->getPointerAddressSpace() != DL.getAllocaAddrSpace()) {
+    LLVM_DEBUG(dbgs() << "[" << F->getName() << "]: "
+                 << "no branchless form, keeping: " << *store << "\n");
+    return false;
+  }
+
+  AllocaInst *scratch = new AllocaInst(Ty, DL.getAllocaAddrSpace(), "phoenix.scratch",
+                                       &*F->getEntryBlock().getFirstInsertionPt());
+  set_alignment(scratch, align);
+
+  // A vector is written if any lane changed
+  Value *write = Ty->isVectorTy() ? Builder.CreateOrReduce(changed) : changed;
+  store->setOperand(1, Builder.CreateSelect(write, store->getPointerOperand(), scratch));
+
+  LLVM_DEBUG(dbgs() << "[" << F->getName() << "]: "
+               << "branchless store: " << *store << "\n");
+  return true;
+}
+
 void insert_on_store(Function *F, ReachableNodes &rn) {
   StoreInst *store = rn.get_store();
   LoadInst *load = rn.get_load();
@@ -174,7 +254,10 @@ void insert_on_store(Function *F, ReachableNodes &rn) {
   // @arith = @load op @other
   // Store @arith, *ptr
   // the store is silent if @arith == @load
-  insert_if(store, arith, load);
+  if (MaskedStore && arith->getType()->isVectorTy() && arith->getType() == load->getType())
+    insert_masked_store(store, load);
+  else
+    insert_if(store, arith, load);
 }
 
 void silent_store_elimination(Function *F, std::vector<ReachableNodes> &reachables) {
@@ -183,20 +266,109 @@ void silent_store_elimination(Function *F, std::vector<ReachableNodes> &reachabl
   }
 }
 
-void load_elimination(Function *F, StoreInst *store, NodeSet &s) {
-  for (auto it = s.begin(); it != s.end(); it++) {
-    phoenix::Node *node = *it;
-    Value *value = node->getValue();
-    Value *constant = node->getConstant();
-    insert_if(store, value, constant);
-    break;
+// What testing @v right before @store costs: the loads, then the other
+// instructions, of the block of @store that compute it. Values defined in
+// other blocks are already in registers
+static std::pair<unsigned, unsigned> guard_cost(Value *v, StoreInst *store) {
+  unsigned loads = 0, insts = 0;
+  SmallPtrSet<Instruction *, 16> visited;
+  SmallVector<Instruction *, 16> worklist;
+
+  if (Instruction *I = dyn_cast<Instruction>(v))
+    worklist.push_back(I);
+
+  while (!worklist.empty()) {
+    Instruction *I = worklist.pop_back_val();
+    if (I->getParent() != store->getParent() || isa<PHINode>(I) || !visited.insert(I).second)
+      continue;
+
+    if (isa<LoadInst>(I))
+      loads++;
+    else
+      insts++;
+
+    for (Value *op : I->operands())
+      if (Instruction *inst = dyn_cast<Instruction>(op))
+        worklist.push_back(inst);
+  }
+
+  return std::make_pair(loads, insts);
+}
+
+llvm::SmallVector<Node *, 10> order_guards(StoreInst *store, NodeSet &s) {
+  llvm::SmallVector<Node *, 10> nodes;
+
+  // A constant node makes the store always silent, there is nothing to test
+  for (Node *node : s)
+    if (!isa<Constant>(node->getValue()))
+      nodes.push_back(node);
+
+  std::stable_sort(nodes.begin(), nodes.end(), [store](Node *a, Node *b) {
+    return guard_cost(a->getValue(), store) < guard_cost(b->getValue(), store);
+  });
+
+  return nodes;
+}
+
+// Expression elision without a branch: the store is written unless one of
+// the nodes of @s that need no load holds its constant. The mask does not
+// wait for the loads of the expression, nor for *p. nullptr when no node is
+// that cheap
+static Value *create_cheap_changed(IRBuilder<> &Builder, StoreInst *store, NodeSet &s) {
+  Value *changed = nullptr;
+
+  for (Node *node : order_guards(store, s)) {
+    Value *v = node->getValue();
+    if (guard_cost(v, store).first > 0 || v->getType() != store->getValueOperand()->getType())
+      continue;
+
+    Value *cmp = create_changed(Builder, v, node->getConstant());
+    changed = changed ? Builder.CreateAnd(changed, cmp) : cmp;
+  }
+
+  return changed;
+}
+
+void branchless_elimination(std::vector<ReachableNodes> &reachables, bool elide,
+                            TargetTransformInfo &TTI) {
+  for (ReachableNodes &rn : reachables) {
+    StoreInst *store = rn.get_store();
+    Value *load = rn.get_load();
+    NodeSet nodes = rn.get_nodeset();
+
+    IRBuilder<> Builder(store);
+    Value *changed = elide ? create_cheap_changed(Builder, store, nodes) : nullptr;
+
+    if (!changed && store->getValueOperand()->getType() == load->getType())
+      changed = create_changed(Builder, store->getValueOperand(), load);
+
+    if (changed)
+      insert_branchless(store, changed, TTI);
+  }
+}
+
+// One guard per node, nested: the store is silent as soon as one node holds
+// its constant, and each test skips the tests after it, the loads they need
+// and the store. DAG::worth_insert_if accepted the first guard, each other
+// one must pay off on what is left under it
+void load_elimination(Function *F, StoreInst *store, NodeSet &s, TargetTransformInfo &TTI) {
+  llvm::SmallVector<Node *, 10> nodes = order_guards(store, s);
+
+  for (unsigned i = 0; i < nodes.size(); i++) {
+    Value *v = nodes[i]->getValue();
+    if (i > 0 && !worth_guard(store, v, IdentityRate, TTI)) {
+      LLVM_DEBUG(dbgs() << "skipping guard on: " << *v << "\n");
+      continue;
+    }
+    insert_if(store, v, nodes[i]->getConstant());
   }
 }
 
-void load_elimination(Function *F, std::vector<ReachableNodes> &reachables) {
+void load_elimination(Function *F, std::vector<ReachableNodes> &reachables,
+                      TargetTransformInfo &TTI) {
   for (ReachableNodes &r : reachables) {
     NodeSet nodes = r.get_nodeset();
-    load_elimination(F, r.get_store(), nodes);
+    load_elimination(F, r.get_store(), nodes, TTI);
   }
 }
 
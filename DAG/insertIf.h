@@ -1,5 +1,7 @@
 #pragma once
 
+#include "llvm/Analysis/TargetTransformInfo.h"
+
 #include "ReachableNodes.h"
 #include "NodeSet.h"
 
@@ -17,12 +19,31 @@ void move_marked_to_basic_block(
 
 void move_from_prev_to_then(BasicBlock *BBPrev, BasicBlock *BBThen);
 
-void insert_if(StoreInst *store, Value *v, Value *constant);
+// Guards @store with `if (@v != @constant)`. @weights, if any, are the
+// !prof weights of the guard
+void insert_if(StoreInst *store, Value *v, Value *constant, MDNode *weights = nullptr);
+void insert_masked_store(StoreInst *store, Value *load);
+
+// Lowers the guard of @store without a branch: only the lanes set in
+// @changed are written. A vector the target stores with a mask becomes
+// llvm.masked.store. Otherwise the address is a select between *p and a
+// slot on the stack. Returns false, keeping @store, for volatile and atomic
+// stores
+bool insert_branchless(StoreInst *store, Value *changed, TargetTransformInfo &TTI);
+// The mask is new != old or, if @elide (-dag-opt=eae), the test of the
+// nodes that need no load
+void branchless_elimination(std::vector<ReachableNodes> &reachables, bool elide,
+                            TargetTransformInfo &TTI);
 
 void insert_on_store(Function *F, std::vector<ReachableNodes> &reachables);
 void silent_store_elimination(Function *F, std::vector<ReachableNodes> &reachables);
 
-void load_elimination(Function *F, StoreInst *store, NodeSet &s);
-void load_elimination(Function *F, std::vector<ReachableNodes> &reachables);
+// The nodes of @s to test, cheapest first: values already computed before
+// those that need loads
+llvm::SmallVector<Node *, 10> order_guards(StoreInst *store, NodeSet &s);
+
+void load_elimination(Function *F, StoreInst *store, NodeSet &s, TargetTransformInfo &TTI);
+void load_elimination(Function *F, std::vector<ReachableNodes> &reachables,
+                      TargetTransformInfo &TTI);
 
 }; // end namespace phoenix
\ No newline at end of file
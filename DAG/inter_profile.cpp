@@ -91,7 +91,7 @@ static BasicBlock *split_pre_header(Loop *L, LoopInfo *LI, DominatorTree *DT) {
   std::swap(pp, ph);
   std::vector<Instruction *> insts;
   for (Instruction &I : *pp) {
-    if (isa<TerminatorInst>(&I))
+    if (I.isTerminator())
       break;
     insts.push_back(&I);
   }
@@ -164,7 +164,7 @@ static void create_new_loops(Loop *OrigLoop,
                              LoopInfo *LI,
                              Loop *ParentLoop,
                              std::map<Loop *, Loop *> &ClonedLoopMap) {
-  if (OrigLoop->empty())
+  if (OrigLoop->getSubLoops().empty())
     return;
 
   for (auto CurrLoop : OrigLoop->getSubLoops()) {
@@ -309,7 +309,7 @@ static void increment_cnt_counter(Function *C, Instruction *value_after, Instruc
   auto *I32Ty = Type::getInt32Ty(C->getContext());
   auto *one = ConstantInt::get(I32Ty, 1);
 
-  LoadInst *counter = Builder.CreateLoad(ptr, "cnt");
+  LoadInst *counter = Builder.CreateLoad(I32Ty, ptr, "cnt");
   Value *inc = Builder.CreateAdd(counter, one, "cnt_inc");
   Builder.CreateStore(inc, ptr);
 }
@@ -324,7 +324,7 @@ static void increment_eq_counter(Function *C,
   auto *zero = ConstantInt::get(I32Ty, 0);
   auto *one = ConstantInt::get(I32Ty, 1);
 
-  LoadInst *counter = Builder.CreateLoad(ptr, "eq_counter");
+  LoadInst *counter = Builder.CreateLoad(I32Ty, ptr, "eq_counter");
 
   Value *cmp;
 
@@ -367,8 +367,8 @@ static void change_return(Function *C, Instruction *eq_ptr, Instruction *cnt_ptr
 
       // cnt is the number of times the sampling function was executed
       // the default value is 1000
-      Instruction *cnt = Builder.CreateLoad(cnt_ptr, "cnt");
-      Instruction *eq = Builder.CreateLoad(eq_ptr, "eq");
+      Instruction *cnt = Builder.CreateLoad(Builder.getInt32Ty(), cnt_ptr, "cnt");
+      Instruction *eq = Builder.CreateLoad(Builder.getInt32Ty(), eq_ptr, "eq");
 
       // now we need to compare if the eq is SMALLER than a threshold
       // if eq ~= cnt, then the store was silent most of the times
@@ -436,7 +436,7 @@ static void limit_num_iter(Function *fn,
   // Loads the counter
   // compare it against num_iter
   IRBuilder<> Builder(split);
-  LoadInst *cnt = Builder.CreateLoad(cnt_ptr);
+  LoadInst *cnt = Builder.CreateLoad(Builder.getInt32Ty(), cnt_ptr);
   Value *cond = Builder.CreateICmpSLT(cnt, num_iter);
   Builder.CreateCondBr(cond, prox, exit);
 }
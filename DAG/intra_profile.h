@@ -24,6 +24,7 @@
 
 #include "insertIf.h"
 #include "utils.h"
+#include "../Support/Compat.h"
 
 namespace phoenix {
 
@@ -55,7 +56,8 @@ Instruction *create_switch(Function *F, BasicBlock *BB, BasicBlock *BBProfile, B
   // 2. Create the switch with a default jump to BBProfile
   BasicBlock *BBSwitch = BasicBlock::Create(F->getContext(), "Switch", F, BB);
   Builder.SetInsertPoint(BBSwitch);
-  Instruction *load = Builder.CreateLoad(switch_control_ptr, "switch_control");
+  Instruction *load =
+      Builder.CreateLoad(Builder.getInt32Ty(), switch_control_ptr, "switch_control");
   SwitchInst *si = Builder.CreateSwitch(load, BBProfile, SWITCH_NUM_CASES);
 
   // Case with 1 with a jump to BB
@@ -68,7 +70,7 @@ Instruction *create_switch(Function *F, BasicBlock *BB, BasicBlock *BBProfile, B
   for (BasicBlock *pred : predecessors(BB)) {
     if (pred == BBSwitch)
       continue;
-    TerminatorInst *TI = pred->getTerminator();
+    Instruction *TI = pred->getTerminator();
 
     switch (TI->getOpcode()) {
       case Instruction::Br:
@@ -106,7 +108,7 @@ AllocaInst *create_c1(Function *F, BasicBlock *BBProfile) {
   // c1 inc
   Builder.SetInsertPoint(BBProfile->getFirstNonPHI());
 
-  LoadInst *load_c1 = Builder.CreateLoad(c1_ptr, "c1.load");
+  LoadInst *load_c1 = Builder.CreateLoad(I32Ty, c1_ptr, "c1.load");
   Value *c1_inc = Builder.CreateAdd(load_c1, one, "c1.inc");
   Builder.CreateStore(c1_inc, c1_ptr);
 
@@ -135,7 +137,7 @@ AllocaInst *create_c2(Function *F, BasicBlock *BBProfile, Value *before, Value *
 
   Value *select = Builder.CreateSelect(cmp, one, zero);
 
-  LoadInst *load_c2 = Builder.CreateLoad(c2_ptr, "c2.load");
+  LoadInst *load_c2 = Builder.CreateLoad(I32Ty, c2_ptr, "c2.load");
   Value *c2_inc = Builder.CreateAdd(load_c2, select, "c2.inc");
   Builder.CreateStore(c2_inc, c2_ptr);
 
@@ -210,9 +212,9 @@ void create_BBControl(Function *F,
   BasicBlock *BBControl = BBProfile->splitBasicBlock(BBProfile->getTerminator(), "BBControl");
   IRBuilder<> Builder(BBControl->getFirstNonPHI());
 
-  Value *c1 = Builder.CreateLoad(c1_ptr, "c1");
-  Value *c2 = Builder.CreateLoad(c2_ptr, "c2");
-  Value *switch_control = Builder.CreateLoad(switch_control_ptr, "switch_control");
+  Value *c1 = Builder.CreateLoad(I32Ty, c1_ptr, "c1");
+  Value *c2 = Builder.CreateLoad(I32Ty, c2_ptr, "c2");
+  Value *switch_control = Builder.CreateLoad(I32Ty, switch_control_ptr, "switch_control");
 
   // if c2 > gap then we change switch_control to jump to BBOpt, otherwise,
   // jump to BB
@@ -296,7 +298,7 @@ void create_phi_nodes(Function *F,
         if (!isa<Instruction>(op))
           continue;
         if (cast<Instruction>(op) == &I) {
-          DEBUG(errs() << "replacing " << *op << " -> " << *phi << "\n");
+          LLVM_DEBUG(errs() << "replacing " << *op << " -> " << *phi << "\n");
           Inst->setOperand(i, phi);
         }
       }
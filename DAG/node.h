@@ -63,6 +63,7 @@ class Node: public Counter, public ConstantWrapper {
     
     NK_BinaryNode,
       NK_TargetOpNode,
+      NK_FusedMulNode,
     NK_BinaryNode_End,
 
     NK_TerminalNode,
@@ -201,6 +202,20 @@ class TargetOpNode : public BinaryNode {
   MAKE_CLASSOF(NK_TargetOpNode, NK_TargetOpNode);
 };
 
+// The product a * b of llvm.fmuladd(a, b, c)/llvm.fma(a, b, c). Its value
+// is the whole call, so it must never be compared against a constant itself
+class FusedMulNode : public BinaryNode {
+ public:
+  FusedMulNode(Node *left, Node *right, Instruction *I) : BinaryNode(left, right, I, NK_FusedMulNode){}
+
+  std::string instType(void) const override {
+    return "fmul";
+  }
+
+  MAKE_VISITABLE;
+  MAKE_CLASSOF(NK_FusedMulNode, NK_FusedMulNode);
+};
+
 class TerminalNode : public Node {
  public:
   TerminalNode(Value *V) : Node(V, NK_TerminalNode) {}
@@ -27,6 +27,8 @@ phoenix::Node* myParser(BasicBlock *BB, Value *V, unsigned pos){
       return new phoenix::ForeignNode(I);
 
     if (isa<InsertElementInst>(I) ||
+        isa<ExtractElementInst>(I) ||
+        isa<ShuffleVectorInst>(I) ||
         isa<SelectInst>(I) ||
         isa<PHINode>(I) ||
         isa<GetElementPtrInst>(I) ||
@@ -51,8 +53,27 @@ phoenix::Node* myParser(BasicBlock *BB, Value *V, unsigned pos){
       return new phoenix::UnaryNode(node, I);
     }
     else if (StoreInst *store = dyn_cast<StoreInst>(I)){
-      phoenix::Node *node = myParser(BB, store->getValueOperand(), pos);
+      // The expression may be computed in a block that dominates the store
+      // and *p loaded in yet another one (see Identify::same_memory_location)
+      Value *value = store->getValueOperand();
+      BasicBlock *valueBB = isa<Instruction>(value) ? cast<Instruction>(value)->getParent() : BB;
+      phoenix::Node *node;
+      if (pos == THIRD) {
+        // fmuladd(a, b, *p) is parsed as (a * b) + *p
+        Instruction *call = cast<Instruction>(value);
+        phoenix::Node *mul = new phoenix::FusedMulNode(myParser(valueBB, call->getOperand(0), pos),
+                                                       myParser(valueBB, call->getOperand(1), pos),
+                                                       call);
+        node = new phoenix::BinaryNode(mul, myParser(valueBB, call->getOperand(2), pos), call);
+        pos = SECOND;
+      }
+      else {
+        node = myParser(valueBB, value, pos);
+      }
       if (phoenix::BinaryNode *binary = dyn_cast<phoenix::BinaryNode>(node)){
+        phoenix::Node *&target = (pos == FIRST) ? binary->left : binary->right;
+        if (isa<phoenix::ForeignNode>(target) && isa<LoadInst>(target->getValue()))
+          target = new phoenix::LoadNode(target->getValue());
         phoenix::TargetOpNode *top = new phoenix::TargetOpNode(binary, pos);
         return new phoenix::StoreNode(top, store);
       }
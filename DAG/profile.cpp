@@ -0,0 +1,173 @@
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstring>
+#include <vector>
+
+#include "../Collect/profile_format.h"
+#include "../Instrumentation/SiteHash.h"
+#include "profile.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<std::string> ProfileFile(
+    "phoenix-profile",
+    cl::desc("Binary profile of CountStores and/or CountArith used by -dag-opt=pgo"),
+    cl::value_desc("file"));
+
+cl::opt<double> ProfileThreshold(
+    "phoenix-profile-threshold",
+    cl::desc("Minimum fraction of silent (or identity) executions for -dag-opt=pgo to guard a "
+             "store"),
+    cl::init(0.2));
+
+cl::opt<std::string> ProfileSites(
+    "phoenix-profile-sites",
+    cl::desc("Site map directory (-phoenix-site-map) of the build that wrote -phoenix-profile, "
+             "required by -dag-opt=pgo to match its sites by site hash"),
+    cl::value_desc("dir"));
+
+// The counters of (@module_hash, @kind) in the profile @buf, empty if there
+// are none or the record is truncated
+static std::vector<uint64_t> read_counters(const MemoryBuffer &buf, uint64_t module_hash,
+                                           uint32_t kind) {
+  const uint8_t *begin = reinterpret_cast<const uint8_t *>(buf.getBufferStart());
+
+  phoenix_prof_header h;
+  if (buf.getBufferSize() < sizeof(h))
+    return {};
+  memcpy(&h, begin, sizeof(h));
+  if (!phoenix_prof_check_header(&h) ||
+      buf.getBufferSize() < sizeof(h) + h.num_modules * sizeof(phoenix_prof_module))
+    return {};
+
+  for (uint32_t m = 0; m < h.num_modules; m++) {
+    phoenix_prof_module entry;
+    memcpy(&entry, begin + sizeof(h) + m * sizeof(entry), sizeof(entry));
+
+    if (entry.module_hash != module_hash || entry.kind != kind)
+      continue;
+    if (entry.offset + entry.size > buf.getBufferSize() || entry.num_sites > entry.size)
+      return {};
+
+    // Skip the info bytes. The counters end with the payload, not the file
+    const uint8_t *p = begin + entry.offset + entry.num_sites;
+    const uint8_t *end = begin + entry.offset + entry.size;
+    std::vector<uint64_t> counters(2 * entry.num_sites);
+    for (uint64_t &c : counters)
+      if (!phoenix_prof_decode(&p, end, &c))
+        return {};
+    return counters;
+  }
+
+  return {};
+}
+
+// Inline counters are kept per module. `record_store` and `record_arith_*`
+// put every site in module 0, which is only meaningful for a program built
+// from one module
+static std::vector<uint64_t> read_counters(const MemoryBuffer &buf, const Module &M,
+                                           uint32_t kind) {
+  std::vector<uint64_t> counters = read_counters(buf, get_module_hash(M), kind);
+  if (counters.empty())
+    counters = read_counters(buf, 0, kind);
+  return counters;
+}
+
+// Joins @counters with the site map of @kind in -phoenix-profile-sites.
+// Returns false if the map could not be read
+static bool add_sites(const std::vector<uint64_t> &counters, uint64_t module_hash, StringRef kind,
+                      DenseMap<uint64_t, std::pair<uint64_t, uint64_t>> &by_site) {
+  std::vector<SiteMapEntry> entries;
+  if (!read_site_map(get_site_map_path(ProfileSites, module_hash, kind), entries))
+    return false;
+
+  for (const SiteMapEntry &e : entries) {
+    if (e.module_hash != module_hash || 2 * e.id + 1 >= counters.size())
+      continue;
+    by_site[e.site] = {counters[2 * e.id], counters[2 * e.id + 1]};
+  }
+  return true;
+}
+
+void StoreProfile::load_module(const std::string &filename, Module &M) {
+  uint64_t hash = get_module_hash(M);
+  this->module_hash = hash;
+  stores_by_site.clear();
+  arith_by_site.clear();
+  counts.clear();
+
+  if (filename.empty()) {
+    errs() << "phoenix: -dag-opt=pgo needs -phoenix-profile=<file>, no store is guarded\n";
+    return;
+  }
+
+  // Positions would attach the counts to the wrong sites as soon as the
+  // module differs from the profiled one
+  if (ProfileSites.empty()) {
+    errs() << "phoenix: -dag-opt=pgo needs -phoenix-profile-sites=<site map directory>, no "
+              "store is guarded\n";
+    return;
+  }
+
+  auto buf = MemoryBuffer::getFile(filename);
+  if (!buf) {
+    errs() << "phoenix: could not read " << filename << ", no store is guarded\n";
+    return;
+  }
+
+  std::vector<uint64_t> stores = read_counters(**buf, M, PHOENIX_STORE_COUNTERS);
+  std::vector<uint64_t> arith = read_counters(**buf, M, PHOENIX_ARITH_COUNTERS);
+
+  if (stores.empty() && arith.empty()) {
+    errs() << "phoenix: " << filename << " has no store or arith counters for " << M.getName()
+           << ", no store is guarded\n";
+    return;
+  }
+
+  if (!stores.empty() && !add_sites(stores, hash, "store", stores_by_site))
+    errs() << "phoenix: could not read " << get_site_map_path(ProfileSites, hash, "store")
+           << ", the store counters are not used\n";
+
+  if (!arith.empty() && !add_sites(arith, hash, "arith", arith_by_site))
+    errs() << "phoenix: could not read " << get_site_map_path(ProfileSites, hash, "arith")
+           << ", the arith counters are not used\n";
+}
+
+void StoreProfile::load(const std::string &filename, Function &F) {
+  if (!module_hash || *module_hash != get_module_hash(*F.getParent()))
+    load_module(filename, *F.getParent());
+  counts.clear();
+
+  // The ordinals of the site hashes are those of @F before the DAG changes it.
+  // Hashes include the opcode, so a store never matches an arith site
+  SiteHasher sites;
+  for (Instruction &I : instructions(F)) {
+    auto &by_site = isa<StoreInst>(I) ? stores_by_site : arith_by_site;
+    if (by_site.empty())
+      continue;
+
+    auto it = by_site.find(sites.get_site_hash(&I));
+    if (it != by_site.end())
+      counts[&I] = it->second;
+  }
+}
+
+Optional<std::pair<uint64_t, uint64_t>> StoreProfile::get_counts(const Instruction *I) const {
+  auto it = counts.find(I);
+  if (it == counts.end() || it->second.second == 0)
+    return None;
+  return it->second;
+}
+
+MDNode *get_branch_weights(LLVMContext &Ctx, uint64_t silent, uint64_t total) {
+  // Weights are 32 bits wide
+  uint64_t scale = (total >> 32) + 1;
+  return MDBuilder(Ctx).createBranchWeights((total - silent) / scale, silent / scale);
+}
+
+};  // end namespace phoenix
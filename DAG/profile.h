@@ -0,0 +1,58 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <string>
+#include <utility>
+
+using namespace llvm;
+
+namespace phoenix {
+
+extern cl::opt<std::string> ProfileFile;
+extern cl::opt<double> ProfileThreshold;
+extern cl::opt<std::string> ProfileSites;
+
+// The counters that CountStores and CountArith collected for a module, read
+// from a binary profile (store.profraw, arith.profraw, or both merged by
+// phoenix-profdata). The ids of the profile are only positions, so the sites
+// are matched through the site maps of the profiled build
+// (-phoenix-profile-sites, see Instrumentation/SiteIds.h). At an extension
+// point the other functions of the module may already be optimized, so each
+// function is matched when the DAG reaches it, before it changes it
+class StoreProfile {
+ private:
+  // Hash of the module loaded: a Module * may be reused once it is freed
+  Optional<uint64_t> module_hash;
+
+  // {hits, total} of each site hash of the module: silent executions of the
+  // stores, executions of the arith instructions where `v` is the identity
+  DenseMap<uint64_t, std::pair<uint64_t, uint64_t>> stores_by_site;
+  DenseMap<uint64_t, std::pair<uint64_t, uint64_t>> arith_by_site;
+
+  // {hits, total} of each store, and arith instruction, of the last
+  // function loaded
+  DenseMap<const Instruction *, std::pair<uint64_t, uint64_t>> counts;
+
+  void load_module(const std::string &filename, Module &M);
+
+ public:
+  // Matches the sites of @F, get_counts then answers for them. Reads
+  // @filename the first time it is called for the module of @F
+  void load(const std::string &filename, Function &F);
+
+  // {silent, total} of the store @S, or {identity, total} of the update
+  // *p = *p `op` v @I (the rate of v == identity). None if it is not in the
+  // profile or never ran
+  Optional<std::pair<uint64_t, uint64_t>> get_counts(const Instruction *I) const;
+};
+
+// !prof weights of the guard `if (store is not silent)`
+MDNode *get_branch_weights(LLVMContext &Ctx, uint64_t silent, uint64_t total);
+
+};  // end namespace phoenix
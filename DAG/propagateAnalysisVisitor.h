@@ -6,14 +6,16 @@
 // Converts a constant of value *v(T) from type T -> t
 // This converts things such as float 0.0000 to int 0
 // and the other way around
+// Vectors are converted lane-wise (splats)
 Value* convert(Value *v, Value *target){
   // errs() << "Converting " << *v << " -> " << *target << "(" << *target->getType() << ")" << "\n";
-  if (!target->getType()->isFloatingPointTy() and !target->getType()->isIntegerTy())
+  Type *scalar = target->getType()->getScalarType();
+  if (!scalar->isFloatingPointTy() and !scalar->isIntegerTy())
     return nullptr;
 
-  if (v->getType()->isFloatingPointTy()){
+  if (v->getType()->getScalarType()->isFloatingPointTy()){
     // v => Float/Double
-    if (target->getType()->isFloatingPointTy()){
+    if (scalar->isFloatingPointTy()){
       // target => Float/Double
       return ConstantFP::get(target->getType(), 0.0);
     }
@@ -22,7 +24,7 @@ Value* convert(Value *v, Value *target){
   }
   else {
     // v => Int
-    if (target->getType()->isFloatingPointTy()){
+    if (scalar->isFloatingPointTy()){
       // Target => Float/Double
       return ConstantFP::get(target->getType(), 0.0);
     }
@@ -60,6 +62,9 @@ Value* getAbsorbing(Instruction *I){
 }
 
 Value* getIdentity(Instruction *I, const Geps *g) {
+  if (is_fused_mul_add(I))
+    return ConstantFP::get(I->getType(), 0.0);
+
   switch (I->getOpcode()) {
   case Instruction::Add:
   case Instruction::Sub:
@@ -176,6 +181,16 @@ class propagateAnalysisVisitor : public Visitor {
     target->getOther()->accept(*this);
   }
 
+  // a * b is zero when a or b is
+  void visit(phoenix::FusedMulNode *fused) override {
+    if (ConstantFP::get(fused->getInst()->getType(), 0.0) != id)
+      return;
+
+    fused->setConstant(id);
+    fused->left->accept(*this);
+    fused->right->accept(*this);
+  }
+
   void visit(phoenix::TerminalNode *term) override {
     term->setConstant(id);
   }
@@ -0,0 +1,112 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include "reduction.h"
+#include "../Support/Compat.h"
+
+#define DEBUG_TYPE "DAG"
+
+using namespace llvm;
+
+namespace phoenix {
+
+static bool is_add(Instruction *I) {
+  return I->getOpcode() == Instruction::Add || I->getOpcode() == Instruction::FAdd ||
+         I->getOpcode() == Instruction::Sub || I->getOpcode() == Instruction::FSub;
+}
+
+static bool is_mul(Instruction *I) {
+  return I->getOpcode() == Instruction::Mul || I->getOpcode() == Instruction::FMul;
+}
+
+// The identity of `op` (and the absorbing element of `*` when it is zero)
+static Constant *get_constant(Type *Ty, bool one) {
+  if (Ty->isFloatingPointTy())
+    return ConstantFP::get(Ty, one ? 1.0 : 0.0);
+  return ConstantInt::get(Ty, one ? 1 : 0);
+}
+
+Value *get_guard(Reduction &r, llvm::SmallVectorImpl<Instruction *> &moved) {
+  Instruction *I = r.get_instruction();
+  Value *v = r.get_v();
+  Value *guard = v;
+
+  // acc += a * b: a == 0 makes both the mul and the add useless
+  Instruction *mul = dyn_cast<Instruction>(v);
+  if (is_add(I) && mul && is_mul(mul) && mul->hasOneUse() &&
+      mul->getParent() == I->getParent()) {
+    guard = isa<Constant>(mul->getOperand(0)) ? mul->getOperand(1) : mul->getOperand(0);
+    moved.push_back(mul);
+  }
+  moved.push_back(I);
+
+  return guard;
+}
+
+static void guard_update(Reduction &r, DominatorTree *DT, LoopInfo *LI) {
+  Instruction *I = r.get_instruction();
+
+  // Instructions moved under the `if`, in program order
+  llvm::SmallVector<Instruction *, 2> moved;
+  Value *guard = get_guard(r, moved);
+  Constant *constant = get_constant(r.get_v()->getType(), !is_add(I));
+
+  LLVM_DEBUG(dbgs() << "[" << I->getFunction()->getName() << "]: "
+               << "guarding reduction: " << *I << " on: " << *guard << "\n");
+
+  IRBuilder<> Builder(moved.front());
+  Value *cmp = guard->getType()->isFloatingPointTy() ? Builder.CreateFCmpUNE(guard, constant)
+                                                     : Builder.CreateICmpNE(guard, constant);
+
+  Instruction *br =
+      llvm::SplitBlockAndInsertIfThen(cmp, moved.front(), false, nullptr, DT, LI);
+
+  BasicBlock *BBThen = br->getParent();
+  BasicBlock *BBPrev = BBThen->getSinglePredecessor();
+  BasicBlock *BBEnd = BBThen->getSingleSuccessor();
+
+  for (Instruction *inst : moved)
+    inst->moveBefore(br);
+
+  // acc is unchanged when the update is skipped
+  llvm::SmallVector<User *, 8> users(I->user_begin(), I->user_end());
+  PHINode *merged = PHINode::Create(I->getType(), 2, "phoenix.acc", &BBEnd->front());
+  for (User *U : users)
+    U->replaceUsesOfWith(I, merged);
+
+  merged->addIncoming(I, BBThen);
+  merged->addIncoming(r.get_phi(), BBPrev);
+}
+
+// *p was not written if the accumulator still holds its initial value. FP
+// values are compared bit by bit: NaN, or +0.0 that became -0.0, is written
+static void guard_write_back(StoreInst *store, Value *init, DominatorTree *DT, LoopInfo *LI) {
+  Value *v = store->getValueOperand();
+
+  IRBuilder<> Builder(store);
+  if (v->getType()->isFloatingPointTy()) {
+    Type *IntTy = Builder.getIntNTy(v->getType()->getPrimitiveSizeInBits());
+    v = Builder.CreateBitCast(v, IntTy);
+    init = Builder.CreateBitCast(init, IntTy);
+  }
+  Value *cmp = Builder.CreateICmpNE(v, init);
+
+  Instruction *br = llvm::SplitBlockAndInsertIfThen(cmp, store, false, nullptr, DT, LI);
+  store->moveBefore(br);
+}
+
+void reduction_elimination(Function *F, llvm::SmallVector<Reduction, 10> &reductions,
+                           DominatorTree *DT, LoopInfo *LI) {
+  for (Reduction &r : reductions) {
+    guard_update(r, DT, LI);
+
+    if (r.get_store_inst() && r.get_init_load())
+      guard_write_back(r.get_store_inst(), r.get_init_load(), DT, LI);
+  }
+}
+
+};  // end namespace phoenix
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+
+#include "../Identify/Reduction.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+// Guards the update of each accumulator (see Identify/Reduction.h) with
+//   if (v != identity) acc = acc `op` v
+// When v = a * b feeds an addition, the guard is on `a` instead and also
+// skips the multiplication. The store after the loop is only executed if the
+// accumulator changed.
+// The value the update of @r is guarded on, and in @moved the instructions
+// the guard skips, in program order
+Value *get_guard(Reduction &r, llvm::SmallVectorImpl<Instruction *> &moved);
+
+void reduction_elimination(Function *F, llvm::SmallVector<Reduction, 10> &reductions,
+                           DominatorTree *DT, LoopInfo *LI);
+
+};  // end namespace phoenix
@@ -5,6 +5,8 @@
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/IR/DebugInfoMetadata.h"
 
+#include "../Support/Compat.h"
+
 using namespace llvm;
 
 namespace phoenix {
@@ -63,7 +65,7 @@ Function *CloneFunction(Function *F, ValueToValueMapTy &VMap, const Twine &name)
     }
 
   SmallVector<ReturnInst *, 8> Returns;  // Ignore returns cloned.
-  CloneFunctionInto(NewF, F, VMap, F->getSubprogram() != nullptr, Returns, ".s", nullptr);
+  phoenix::clone_function_into(NewF, F, VMap, Returns, ".s");
 
   return NewF;
 }
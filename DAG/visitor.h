@@ -8,6 +8,7 @@ namespace phoenix{
 
   class BinaryNode;
   class TargetOpNode;
+  class FusedMulNode;
 
   class TerminalNode;
   class LoadNode;
@@ -25,6 +26,7 @@ class Visitor{
   virtual void visit(phoenix::CastNode*) = 0;
   virtual void visit(phoenix::BinaryNode*) = 0;
   virtual void visit(phoenix::TargetOpNode*) = 0;
+  virtual void visit(phoenix::FusedMulNode*) = 0;
   virtual void visit(phoenix::TerminalNode*) = 0;
   virtual void visit(phoenix::LoadNode*) = 0;
   virtual void visit(phoenix::ForeignNode*) = 0;
@@ -1,9 +1,19 @@
 #pragma once
 
+#include "llvm/IR/IntrinsicInst.h"
+
 using namespace llvm;
 
 #include "Position.h"
 
+// llvm.fmuladd(a, b, c) and llvm.fma(a, b, c): a * b + c. clang emits them
+// for `c += a * b` with -ffp-contract=on
+inline bool is_fused_mul_add(const Value *V) {
+  if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(V))
+    return II->getIntrinsicID() == Intrinsic::fmuladd || II->getIntrinsicID() == Intrinsic::fma;
+  return false;
+}
+
 // This instruction encapsulates the necessary things to keep track of
 // instructions that follows the patterns that we are looking for
 // The instructions of interest are of the form:
@@ -11,11 +21,12 @@ using namespace llvm;
 // where `op` can be +, -, *, /, >>, <<, ...
 struct Geps {
  private:
-  // The GetElementPtrInst instructions below are used by the profiler
+  // The pointers written (store) and read (load). Usually GEPs, but they can
+  // also be globals, struct fields or any other pointer. Used by the profiler
   // to check if the addresses are the same at runtime. Just a sanity check
   // to see how accurate our static analysis is!
-  GetElementPtrInst *dest_gep;
-  GetElementPtrInst *op_gep;
+  Value *dest_ptr;
+  Value *op_ptr;
 
   // The instruction where all this mess came from
   //   I: *p_after = *p_before `op` v
@@ -23,6 +34,8 @@ struct Geps {
   Instruction *I;
   Value *p_before;
   Value *p_after;
+  // nullptr for a fused multiply-add, where v is the product of the first
+  // two operands (*p is the THIRD one)
   Value *v;
 
   // Is *p_before the first or the second operand?
@@ -35,22 +48,26 @@ struct Geps {
   unsigned loop_depth;
 
  public:
-  Geps(GetElementPtrInst *dest,
-       GetElementPtrInst *op,
+  Geps(Value *dest,
+       Value *op,
        StoreInst *si,
        LoadInst *load,
        Instruction *I,
        unsigned pos)
-      : dest_gep(dest), op_gep(op), store(si), load(load), I(I), operand_pos(pos), loop_depth(0) {
-    assert(operand_pos == FIRST || operand_pos == SECOND);
+      : dest_ptr(dest), op_ptr(op), store(si), load(load), I(I), operand_pos(pos), loop_depth(0) {
+    assert(operand_pos == FIRST || operand_pos == SECOND ||
+           (operand_pos == THIRD && is_fused_mul_add(I)));
 
     p_after = I;
     p_before = I->getOperand(operand_pos - 1);
-    v = I->getOperand(operand_pos == FIRST ? 1 : 0);
+    if (operand_pos == THIRD)
+      v = nullptr;
+    else
+      v = I->getOperand(operand_pos == FIRST ? 1 : 0);
   }
 
-  GetElementPtrInst *get_dest_gep() const { return dest_gep; }
-  GetElementPtrInst *get_op_gep() const { return op_gep; }
+  Value *get_dest_ptr() const { return dest_ptr; }
+  Value *get_op_ptr() const { return op_ptr; }
   StoreInst *get_store_inst() const { return store; }
   LoadInst *get_load_inst() const { return load; }
   unsigned get_operand_pos() const { return operand_pos; }
@@ -60,6 +77,12 @@ struct Geps {
   Value *get_p_before() const { return p_before; }
   Value *get_p_after() const { return p_after; }
   Instruction *get_instruction() const { return I; }
+  bool is_fused() const { return operand_pos == THIRD; }
+
+  // Load, arithmetic and store in the same basic block
+  bool is_local() const {
+    return load->getParent() == I->getParent() && I->getParent() == store->getParent();
+  }
 
   unsigned get_loop_depth() const { return loop_depth; }
   void set_loop_depth(unsigned depth) { loop_depth = depth; }
@@ -1,7 +1,8 @@
 #include "llvm/ADT/Statistic.h" // For the STATISTIC macro.
+#include "llvm/Analysis/AliasAnalysis.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemoryLocation.h"
 #include "llvm/Analysis/MemorySSA.h"
-#include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/VectorUtils.h"
 #include "llvm/IR/Constants.h"         // For ConstantData, for instance.
@@ -18,6 +19,7 @@
 #include "llvm/Support/raw_ostream.h" // For dbgs()
 #include "llvm/Transforms/Scalar/EarlyCSE.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"  // RecurrenceDescriptor
 
 #include <fstream>
 #include <iostream>
@@ -28,10 +30,15 @@ using std::set;
 using std::stack;
 
 #include "Identify.h"
+#include "../Support/Compat.h"
 
 #define DEBUG_TYPE "Identify"
 
 bool Identify::is_arith_inst_of_interest(Instruction *I) {
+  // *p = fmuladd(a, b, *p): the store is silent when a or b is zero
+  if (is_fused_mul_add(I))
+    return true;
+
   switch (I->getOpcode()) {
   case Instruction::Add:
   case Instruction::Sub:
@@ -56,6 +63,11 @@ bool Identify::is_arith_inst_of_interest(Instruction *I) {
 
 Value *Identify::get_identity(const Geps &g) {
   Instruction *I = g.get_instruction();
+
+  // The identity of the addition, i.e. the absorbing element of a * b
+  if (g.is_fused())
+    return ConstantFP::get(I->getType(), 0.0);
+
   switch (I->getOpcode()) {
   case Instruction::Add:
   case Instruction::Sub:
@@ -90,6 +102,13 @@ Value *Identify::get_identity(const Geps &g) {
 }
 
 bool Identify::can_insert_if(const Geps &g) {
+  // fmuladd(a, b, *p): a * b is only known if both are constants, and
+  // instCombine would have folded it
+  if (g.is_fused()) {
+    Instruction *I = g.get_instruction();
+    return !isa<Constant>(I->getOperand(0)) || !isa<Constant>(I->getOperand(1));
+  }
+
   // v is the operand that is not *p
   if (Constant *c = dyn_cast<Constant>(g.get_v())) {
     if (c != get_identity(g))
@@ -150,14 +169,20 @@ bool Identify::can_insert_if(const Geps &g) {
 Optional<StoreInst *> Identify::can_reach_store(Instruction *I) {
   assert(is_arith_inst_of_interest(I));
 
+  Optional<StoreInst *> other_block = None;
+
   for (Value *op : I->users()) {
     if (StoreInst *si = dyn_cast<StoreInst>(op)) {
-      if (I->getParent() == si->getParent()) // The store should be in the same basic block
+      if (si->getValueOperand() != I)
+        continue;
+      if (I->getParent() == si->getParent()) // Prefer a store in the same basic block
         return si;
+      if (!other_block)
+        other_block = si;
     }
   }
 
-  return None;
+  return other_block;
 }
 
 // Let's just check if the operands of the two instructiosn are the same
@@ -166,17 +191,17 @@ bool Identify::check_operands_equals(const Value *vu, const Value *vv) {
     return true;
 
   if (!isa<Instruction>(vu) || !isa<Instruction>(vv))
-    return false;
+    return same_scev(vu, vv);
 
   const Instruction *u = dyn_cast<Instruction>(vu);
   const Instruction *v = dyn_cast<Instruction>(vv);
 
   if (u->getNumOperands() != v->getNumOperands())
-    return false;
+    return same_scev(vu, vv);
 
   for (unsigned i = 0; i < u->getNumOperands(); i++)
     if (u->getOperand(i) != v->getOperand(i))
-      return false;
+      return same_scev(vu, vv);
 
   // Insane check
   if (u->getType() != v->getType())
@@ -185,60 +210,129 @@ bool Identify::check_operands_equals(const Value *vu, const Value *vv) {
   return true;
 }
 
-// This method checks if op was produced by a LoadInst whose
-// the pointer loaded is the same as the dest_gep
-// Given that every GetElementPtrInst has a %base pointer as
-// as well as an %offset, we just compare them.
-Optional<GetElementPtrInst *> Identify::check_op(LoadInst *li,
-                                                 GetElementPtrInst *dest_gep) {
+// Two integers (or pointers) holding the same value, according to
+// ScalarEvolution: i*n + j computed in different ways, a sext and a zext of
+// the same non-negative index, ...
+bool Identify::same_scev(const Value *vu, const Value *vv) {
+  if (vu->getType() != vv->getType() || !SE->isSCEVable(vu->getType()))
+    return false;
 
-  GetElementPtrInst *op_gep = nullptr;
+  const SCEV *u = SE->getSCEV(const_cast<Value *>(vu));
+  const SCEV *v = SE->getSCEV(const_cast<Value *>(vv));
+  if (u == v)
+    return true;
 
-  // To-Do: Check for other types? I know that %ptr can be a global variable
-  if (BitCastInst *bit = dyn_cast<BitCastInst>(li->getPointerOperand())){
-    if (isa<GetElementPtrInst>(bit->getOperand(0)))
-      op_gep = cast<GetElementPtrInst>(bit->getOperand(0));
-    else
-      return None;
-  }
-  else if (isa<GetElementPtrInst>(li->getPointerOperand())){
-    op_gep = cast<GetElementPtrInst>(li->getPointerOperand());
-  }
-  else {
-    return None;
-  }
+  if (isa<SCEVCouldNotCompute>(u) || isa<SCEVCouldNotCompute>(v))
+    return false;
 
-  // To-Do, check for types other than GetElementPtrInst
-  // if (!isa<GetElementPtrInst>(li->getPointerOperand()))
-    // return None;
+  return SE->getMinusSCEV(u, v)->isZero();
+}
 
-  // GetElementPtrInst *op_gep =
-      // cast<GetElementPtrInst>(li->getPointerOperand());
+// @load and @store access the same address with the same type. The
+// addresses are compared as SCEVs, which sees through bitcasts and nested
+// or linearized GEPs: gep(gep(a, i), j) and gep(a, i*n + j)
+bool Identify::same_address(LoadInst *load, StoreInst *store) {
+  if (load->getType() != store->getValueOperand()->getType())
+    return false;
 
+  Value *dest = store->getPointerOperand();
+  Value *op = load->getPointerOperand();
+  if (dest->getType() != op->getType())
+    return false;
+
+  return same_scev(dest, op);
+}
+
+Value *Identify::strip_bitcasts(Value *ptr) {
+  while (BitCastInst *bit = dyn_cast<BitCastInst>(ptr))
+    ptr = bit->getOperand(0);
+  return ptr;
+}
+
+// This method checks if both geps compute the same pointer.
+// Given that every GetElementPtrInst has a %base pointer as
+// as well as an %offset, we just compare them.
+bool Identify::check_op(GetElementPtrInst *dest_gep, GetElementPtrInst *op_gep) {
   // Check 4: Pointers should be from the same basic block
   if (dest_gep->getParent() != op_gep->getParent())
-    return None;
+    return false;
 
   // Check 5: both geps should have the same type
   if (dest_gep->getType() != op_gep->getType())
-    return None;
+    return false;
 
   // errs() << *dest_gep << "\n";
   // errs() << *op_gep << "\n";
 
   if (dest_gep->getNumOperands() != op_gep->getNumOperands())
-    return None;
+    return false;
 
   // Check the base pointers first
   if (dest_gep->getPointerOperand() != op_gep->getPointerOperand())
-    return None;
+    return false;
 
   for (unsigned i = 1; i < dest_gep->getNumOperands(); i++) {
     if (!check_operands_equals(dest_gep->getOperand(i), op_gep->getOperand(i)))
-      return None;
+      return false;
   }
 
-  return op_gep;
+  return true;
+}
+
+// The load and the store use the same pointer: the same global, the same
+// raw pointer (*p += v), or geps with the same base and offsets (arrays and
+// struct fields)
+bool Identify::same_pointer(LoadInst *load, StoreInst *store) {
+  if (load->getType() != store->getValueOperand()->getType())
+    return false;
+
+  Value *dest = strip_bitcasts(store->getPointerOperand());
+  Value *op = strip_bitcasts(load->getPointerOperand());
+  if (dest == op)
+    return true;
+
+  GetElementPtrInst *dest_gep = dyn_cast<GetElementPtrInst>(dest);
+  GetElementPtrInst *op_gep = dyn_cast<GetElementPtrInst>(op);
+  return dest_gep && op_gep && check_op(dest_gep, op_gep);
+}
+
+// Checks 4 and 5 for a load and a store in different basic blocks, e.g.
+// after loop rotation or when the update is guarded by an `if`:
+//
+//   %old = load %q           ; BB1
+//   %new = add %old, %v      ; BB1 or BB2
+//   store %new, %ptr         ; BB2
+//
+// %q and %ptr must be the same address (SCEV, or MustAlias according to
+// AA) and MemorySSA must show that no write to it happens between the load
+// and the store, i.e. both see the same clobbering access. The load must dominate the store and both must be
+// in the same loop, so that each execution of the store pairs with the last
+// execution of the load.
+bool Identify::same_memory_location(LoadInst *load, StoreInst *store) {
+  if (!load->isSimple() || !store->isSimple())
+    return false;
+
+  if (!DT->dominates(load, store) ||
+      LI->getLoopFor(load->getParent()) != LI->getLoopFor(store->getParent()))
+    return false;
+
+  if (load->getType() != store->getValueOperand()->getType())
+    return false;
+
+  if (!same_address(load, store) &&
+      AA->alias(MemoryLocation::get(load), MemoryLocation::get(store)) != AliasResult::MustAlias)
+    return false;
+
+  MemorySSAWalker *walker = MSSA->getWalker();
+  MemoryUseOrDef *store_access = MSSA->getMemoryAccess(store);
+  if (!store_access)
+    return false;
+
+  MemoryAccess *load_clobber = walker->getClobberingMemoryAccess(load);
+  MemoryAccess *store_clobber = walker->getClobberingMemoryAccess(
+      store_access->getDefiningAccess(), MemoryLocation::get(store));
+
+  return load_clobber == store_clobber;
 }
 
 // Iterate backwards to find a LoadInst from the instruction *I
@@ -297,9 +391,8 @@ Optional<Geps> Identify::good_to_go(Instruction *I) {
   //     In the case above, both geps will hold diferent values since the first
   //     is a gep for an int* and the second for a char*
   //
-  //  Idea: Use RangeAnalysis here to check the offset? Maybe!?
-  //  If we use RangeAnalysis, we can drop check 4 when the base pointers are
-  //  the same
+  //  When the geps are not syntactically equal, we still accept the pair if
+  //  ScalarEvolution proves that both addresses are the same (same_address)
   //
   //  Tip: -early-cse makes the analysis easier because it remove redundant computations
 
@@ -312,39 +405,32 @@ Optional<Geps> Identify::good_to_go(Instruction *I) {
   if (!store)
     return None;
 
-  GetElementPtrInst *dest_gep = nullptr;
-
-  // To-Do: Check for other types? I know that %ptr can be a global variable
-  if (BitCastInst *bit = dyn_cast<BitCastInst>((*store)->getPointerOperand())){
-    if (isa<GetElementPtrInst>(bit->getOperand(0)))
-      dest_gep = cast<GetElementPtrInst>(bit->getOperand(0));
-    else
-      return None;
-  }
-  else if (isa<GetElementPtrInst>((*store)->getPointerOperand())){
-    dest_gep = cast<GetElementPtrInst>((*store)->getPointerOperand());
-  }
-  else {
-    return None;
-  }
+  Value *dest_ptr = (*store)->getPointerOperand();
 
-  // Perform a check on both operands
-  for (unsigned num_op = 0; num_op < 2; ++num_op) {
+  // Perform a check on both operands. Only the addend of a fused
+  // multiply-add can be *p
+  unsigned first_op = is_fused_mul_add(I) ? 2 : 0;
+  unsigned last_op = is_fused_mul_add(I) ? 3 : 2;
+  for (unsigned num_op = first_op; num_op < last_op; ++num_op) {
 
     // Check 3
     LoadInst *load = find_load_inst(I->getOperand(num_op));
     if (load == nullptr)
       continue;
 
+    Value *op_ptr = load->getPointerOperand();
+
     // Check 4: Same basic block
-    if (load->getParent() != I->getParent())
+    if (load->getParent() == I->getParent() && I->getParent() == (*store)->getParent()) {
+      // Check 5: the same pointer or, when computed differently, the same address
+      if (same_pointer(load, *store) || same_address(load, *store))
+        return Geps(dest_ptr, op_ptr, *store, load, I, num_op + 1);
       continue;
-
-    // Check 5:
-    if (Optional<GetElementPtrInst *> op_gep = check_op(load, dest_gep)) {
-      return Geps(dest_gep, *op_gep, *store, load, I, num_op + 1);
     }
 
+    // Checks 4 and 5 across basic blocks
+    if (same_memory_location(load, *store))
+      return Geps(dest_ptr, op_ptr, *store, load, I, num_op + 1);
   }
 
   return None;
@@ -352,22 +438,167 @@ Optional<Geps> Identify::good_to_go(Instruction *I) {
 
 //
 
-llvm::SmallVector<Geps, 10> Identify::get_instructions_of_interest() {
+llvm::SmallVector<Geps, 10> &Identify::get_instructions_of_interest() {
   return instructions_of_interest;
 }
 
+// A reduction phi of L (see Reduction.h) updated by a single arithmetic
+// instruction of interest. RecurrenceDescriptor already checked that the
+// accumulator is not used elsewhere in the loop
+Optional<Reduction> Identify::match_reduction(PHINode *phi, Loop *L) {
+  RecurrenceDescriptor RD;
+  if (!RecurrenceDescriptor::isReductionPHI(phi, L, RD))
+    return None;
+
+  if (phoenix::get_reduction_kind(RD) == phoenix::ReductionKind::Other)
+    return None;
+
+  BasicBlock *latch = L->getLoopLatch();
+  BasicBlock *preheader = L->getLoopPreheader();
+  if (!latch || !preheader)
+    return None;
+
+  Instruction *I = dyn_cast<Instruction>(phi->getIncomingValueForBlock(latch));
+  if (!I || I != RD.getLoopExitInstr() || !isa<BinaryOperator>(I) ||
+      !is_arith_inst_of_interest(I))
+    return None;
+
+  unsigned pos;
+  if (I->getOperand(0) == phi)
+    pos = FIRST;
+  else if (I->getOperand(1) == phi)
+    pos = SECOND;
+  else
+    return None;
+
+  // acc = v - acc has no identity on v
+  if (!I->isCommutative() && pos != FIRST)
+    return None;
+
+  // The store after the loop, either of I or of its LCSSA phi
+  StoreInst *store = nullptr;
+  for (User *U : I->users()) {
+    if (StoreInst *si = dyn_cast<StoreInst>(U))
+      if (si->getValueOperand() == I && !L->contains(si))
+        store = si;
+
+    if (PHINode *lcssa = dyn_cast<PHINode>(U))
+      if (lcssa->getNumIncomingValues() == 1 && !L->contains(lcssa))
+        for (User *UU : lcssa->users())
+          if (StoreInst *si = dyn_cast<StoreInst>(UU))
+            if (si->getValueOperand() == lcssa)
+              store = si;
+  }
+
+  // The value of *p before the loop, when the store can be skipped
+  LoadInst *init = dyn_cast<LoadInst>(phi->getIncomingValueForBlock(preheader));
+  if (!store || !init || !same_memory_location(init, store))
+    init = nullptr;
+
+  return Reduction(phi, I, L, pos, store, init);
+}
+
+void Identify::find_reductions() {
+  for (Loop *L : LI->getLoopsInPreorder()) {
+    for (Instruction &inst : *L->getHeader()) {
+      PHINode *phi = dyn_cast<PHINode>(&inst);
+      if (!phi)
+        break;
+
+      Optional<Reduction> r = match_reduction(phi, L);
+      if (!r)
+        continue;
+
+      // Already handled as *p = *p `op` v
+      Instruction *I = r->get_instruction();
+      if (any_of(instructions_of_interest,
+                 [I](const Geps &g) { return g.get_instruction() == I; }))
+        continue;
+
+      reductions.push_back(*r);
+    }
+  }
+}
+
+llvm::SmallVector<Reduction, 10> &Identify::get_reductions() {
+  return reductions;
+}
+
+Constant *Identify::get_identity(AtomicRMWInst *RMW) {
+  IntegerType *T = dyn_cast<IntegerType>(RMW->getValOperand()->getType());
+  if (!T)
+    return nullptr;
+
+  unsigned bits = T->getBitWidth();
+
+  switch (RMW->getOperation()) {
+  case AtomicRMWInst::Add:
+  case AtomicRMWInst::Sub:
+  case AtomicRMWInst::Or:
+  case AtomicRMWInst::Xor:
+  case AtomicRMWInst::UMax:
+    return ConstantInt::get(T, 0);
+  case AtomicRMWInst::And:
+  case AtomicRMWInst::UMin:
+    return ConstantInt::get(T, APInt::getMaxValue(bits));
+  case AtomicRMWInst::Max:
+    return ConstantInt::get(T, APInt::getSignedMinValue(bits));
+  case AtomicRMWInst::Min:
+    return ConstantInt::get(T, APInt::getSignedMaxValue(bits));
+  default:
+    // xchg, nand
+    return nullptr;
+  }
+}
+
+// atomic_fetch_add(&x, delta) takes the cache line exclusive even when
+// delta == 0. Keep the ones whose operand is not known to be something else.
+// Only monotonic and acquire RMWs read like a load: a release one also heads
+// or continues a release sequence, and a fence and a load do not
+void Identify::find_atomics(Function &F) {
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      AtomicRMWInst *RMW = dyn_cast<AtomicRMWInst>(&I);
+      if (!RMW || RMW->isVolatile())
+        continue;
+
+      if (RMW->getOrdering() != AtomicOrdering::Monotonic &&
+          RMW->getOrdering() != AtomicOrdering::Acquire)
+        continue;
+
+      Constant *identity = get_identity(RMW);
+      if (!identity)
+        continue;
+
+      if (isa<Constant>(RMW->getValOperand()) && RMW->getValOperand() != identity)
+        continue;
+
+      atomics.push_back(RMW);
+    }
+  }
+}
+
+llvm::SmallVector<AtomicRMWInst *, 10> &Identify::get_atomics() {
+  return atomics;
+}
+
 void Identify::set_loop_depth(LoopInfo *LI, Geps &g){
   BasicBlock *BB = g.get_instruction()->getParent();
   unsigned depth = LI->getLoopDepth(BB);
   g.set_loop_depth(depth);
 }
 
-bool Identify::runOnFunction(Function &F) {
-
-  // Grab loop info
-  LoopInfo *LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+void Identify::analyze(Function &F, LoopInfo &LI, DominatorTree &DT, AliasAnalysis &AA,
+                       MemorySSA &MSSA, ScalarEvolution &SE) {
+  this->LI = &LI;
+  this->DT = &DT;
+  this->AA = &AA;
+  this->MSSA = &MSSA;
+  this->SE = &SE;
 
   instructions_of_interest.clear();
+  reductions.clear();
+  atomics.clear();
 
   for (auto &BB : F) {
     for (auto &I : BB) {
@@ -380,28 +611,61 @@ bool Identify::runOnFunction(Function &F) {
   }
 
   for(Geps &g : instructions_of_interest)
-    set_loop_depth(LI, g);
+    set_loop_depth(this->LI, g);
+
+  find_reductions();
+  find_atomics(F);
 
   for (const Geps g : instructions_of_interest) {
     const Instruction *I = g.get_instruction();
     const DebugLoc &loc = I->getDebugLoc();
     if (loc) {
       auto *Scope = cast<DIScope>(loc.getScope());
-      DEBUG(dbgs() << *I << " [" << Scope->getFilename() << ":" << loc.getLine()
+      LLVM_DEBUG(dbgs() << *I << " [" << Scope->getFilename() << ":" << loc.getLine()
                    << "]"
                    << "\n");
     }
   }
+}
+
+bool Identify::invalidate(Function &F, const PreservedAnalyses &PA,
+                          FunctionAnalysisManager::Invalidator &Inv) {
+  auto PAC = PA.getChecker<IdentifyAnalysis>();
+  return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>()) ||
+         Inv.invalidate<LoopAnalysis>(F, PA);
+}
 
+bool IdentifyWrapperPass::runOnFunction(Function &F) {
+  Idtf.analyze(F,
+               getAnalysis<LoopInfoWrapperPass>().getLoopInfo(),
+               getAnalysis<DominatorTreeWrapperPass>().getDomTree(),
+               getAnalysis<AAResultsWrapperPass>().getAAResults(),
+               getAnalysis<MemorySSAWrapperPass>().getMSSA(),
+               getAnalysis<ScalarEvolutionWrapperPass>().getSE());
   return false;
 }
 
-void Identify::getAnalysisUsage(AnalysisUsage &AU) const {
+void IdentifyWrapperPass::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequired<LoopInfoWrapperPass>();
   AU.addRequired<DominatorTreeWrapperPass>();
-  AU.addRequired<PostDominatorTreeWrapperPass>();
+  AU.addRequired<AAResultsWrapperPass>();
+  AU.addRequired<MemorySSAWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
   AU.setPreservesAll();
 }
 
-char Identify::ID = 0;
-static RegisterPass<Identify> X("Identify", "Find pattern *p = *p `op` v");
+char IdentifyWrapperPass::ID = 0;
+static RegisterPass<IdentifyWrapperPass> X("Identify", "Find pattern *p = *p `op` v");
+
+AnalysisKey IdentifyAnalysis::Key;
+
+Identify IdentifyAnalysis::run(Function &F, FunctionAnalysisManager &FAM) {
+  Identify Idtf;
+  Idtf.analyze(F,
+               FAM.getResult<LoopAnalysis>(F),
+               FAM.getResult<DominatorTreeAnalysis>(F),
+               FAM.getResult<AAManager>(F),
+               FAM.getResult<MemorySSAAnalysis>(F).getMSSA(),
+               FAM.getResult<ScalarEvolutionAnalysis>(F));
+  return Idtf;
+}
@@ -1,23 +1,43 @@
 #pragma once
 
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/PassManager.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/Passes/PassBuilder.h"
+#endif
+
 using namespace llvm;
 
 #include <vector>
 
 #include "Position.h"
 #include "Geps.h"
+#include "Reduction.h"
 
-class Identify : public FunctionPass {
+// The sites of a function. Computed by IdentifyWrapperPass (legacy pass
+// manager) and IdentifyAnalysis (new pass manager), both cache it until the
+// function changes
+class Identify {
 private:
 
   llvm::SmallVector<Geps, 10> instructions_of_interest;
+  llvm::SmallVector<Reduction, 10> reductions;
+  llvm::SmallVector<AtomicRMWInst *, 10> atomics;
+
+  LoopInfo *LI;
+  DominatorTree *DT;
+  AliasAnalysis *AA;
+  MemorySSA *MSSA;
+  ScalarEvolution *SE;
 
   // Check if the instruction I is an arithmetic instruction
   // of interest. We don't instrument Floating-Point instructions
   // because they don't have an identity.
   bool is_arith_inst_of_interest(Instruction *I);
 
-  Value* get_identity(const Geps &g);
   bool can_insert_if(const Geps &g);
 
   // Find a LoadInst from *I
@@ -29,12 +49,51 @@ private:
 
   //
   bool check_operands_equals(const Value *vu, const Value *vv);
-  Optional<GetElementPtrInst*> check_op(LoadInst *li, GetElementPtrInst *dest_gep);
+  bool same_scev(const Value *vu, const Value *vv);
+  bool same_address(LoadInst *load, StoreInst *store);
+  Value *strip_bitcasts(Value *ptr);
+  bool check_op(GetElementPtrInst *dest_gep, GetElementPtrInst *op_gep);
+  bool same_pointer(LoadInst *load, StoreInst *store);
+  // Load and store in different basic blocks access the same memory and
+  // nothing writes to it in between (AA + MemorySSA)
+  bool same_memory_location(LoadInst *load, StoreInst *store);
   Optional<Geps> good_to_go(Instruction *I);
 
+  // Accumulators promoted to registers by LICM
+  Optional<Reduction> match_reduction(PHINode *phi, Loop *L);
+  void find_reductions();
+
+  // atomicrmw whose operand may be the identity
+  void find_atomics(Function &F);
+
   // gather info about I
   void set_loop_depth(LoopInfo *LI, Geps &g);
 
+public:
+  void analyze(Function &F, LoopInfo &LI, DominatorTree &DT, AliasAnalysis &AA, MemorySSA &MSSA,
+               ScalarEvolution &SE);
+
+  // New pass manager: Geps and Reduction point to instructions and loops, so
+  // the result is dropped unless the pass preserves it and LoopInfo
+  bool invalidate(Function &F, const PreservedAnalyses &PA,
+                  FunctionAnalysisManager::Invalidator &Inv);
+
+  llvm::SmallVector<Geps, 10> &get_instructions_of_interest();
+  llvm::SmallVector<Reduction, 10> &get_reductions();
+  llvm::SmallVector<AtomicRMWInst *, 10> &get_atomics();
+
+  // The identity of `op` in `*p = *p op v`
+  static Value* get_identity(const Geps &g);
+  // The operand that leaves memory unchanged, nullptr if there is none
+  static Constant* get_identity(AtomicRMWInst *RMW);
+
+};
+
+// Legacy pass manager
+class IdentifyWrapperPass : public FunctionPass {
+private:
+  Identify Idtf;
+
 public:
   // Pass identifier, for LLVM's RTTI support:
   static char ID;
@@ -42,8 +101,29 @@ public:
   bool runOnFunction(Function &);
   void getAnalysisUsage(AnalysisUsage &AU) const;
 
-  llvm::SmallVector<Geps, 10> get_instructions_of_interest();
+  Identify &getIdentify() { return Idtf; }
 
-  Identify() : FunctionPass(ID) {}
-  ~Identify() {}
+  IdentifyWrapperPass() : FunctionPass(ID) {}
+  ~IdentifyWrapperPass() {}
 };
+
+// New pass manager
+class IdentifyAnalysis : public AnalysisInfoMixin<IdentifyAnalysis> {
+  friend AnalysisInfoMixin<IdentifyAnalysis>;
+  static AnalysisKey Key;
+
+public:
+  using Result = Identify;
+
+  Identify run(Function &F, FunctionAnalysisManager &FAM);
+};
+
+#if LLVM_VERSION_MAJOR >= 14
+// Plugins (DAG, CountArith, CountStores) register IdentifyAnalysis along with
+// their own passes
+inline void register_identify(PassBuilder &PB) {
+  PB.registerAnalysisRegistrationCallback([](FunctionAnalysisManager &FAM) {
+    FAM.registerPass([] { return IdentifyAnalysis(); });
+  });
+}
+#endif
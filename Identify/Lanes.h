@@ -0,0 +1,30 @@
+#pragma once
+
+#include "llvm/IR/IRBuilder.h"
+
+#include "../Support/Compat.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+// Vector instructions (after LoopVectorize) are compared lane-wise. These
+// reduce an <N x i1> comparison to the i1 guarding the whole vector
+inline Value *all_lanes(IRBuilder<> &Builder, Value *cmp) {
+  if (!cmp->getType()->isVectorTy())
+    return cmp;
+  return Builder.CreateAndReduce(cmp);
+}
+
+// Lane @lane of @v, or @v itself when it is a scalar
+inline Value *get_lane(IRBuilder<> &Builder, Value *v, unsigned lane) {
+  if (!v->getType()->isVectorTy())
+    return v;
+  return Builder.CreateExtractElement(v, Builder.getInt32(lane));
+}
+
+inline unsigned get_num_lanes(Type *T) {
+  return T->isVectorTy() ? get_vector_num_elements(T) : 1;
+}
+
+};  // namespace phoenix
@@ -2,5 +2,6 @@
 
 enum {
   FIRST = 1,
-  SECOND = 2
+  SECOND = 2,
+  THIRD = 3  // the addend of llvm.fmuladd/llvm.fma
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+using namespace llvm;
+
+#include "Position.h"
+
+// After LICM promotes *p to a register, the pattern *p = *p `op` v becomes a
+// loop-carried phi (a reduction) with a single store after the loop:
+//
+//   preheader:
+//     %init = load %ptr
+//   header:
+//     %acc = phi [%init, %preheader], [%new, %latch]
+//     ...
+//     I: %new = %acc `op` v
+//   exit:
+//     store %new, %ptr
+//
+// `store` and `init` are optional: the accumulator may come from and go to
+// anywhere (a return value, for instance)
+struct Reduction {
+ private:
+  PHINode *phi;
+  Instruction *I;
+  Loop *L;
+
+  // Is %acc the first or the second operand of I?
+  unsigned operand_pos;
+  Value *v;
+
+  StoreInst *store;
+  LoadInst *init;
+
+ public:
+  Reduction(PHINode *phi, Instruction *I, Loop *L, unsigned pos, StoreInst *store, LoadInst *init)
+      : phi(phi), I(I), L(L), operand_pos(pos), store(store), init(init) {
+    assert(operand_pos == FIRST || operand_pos == SECOND);
+    v = I->getOperand(operand_pos == FIRST ? 1 : 0);
+  }
+
+  PHINode *get_phi() const { return phi; }
+  Instruction *get_instruction() const { return I; }
+  Loop *get_loop() const { return L; }
+  unsigned get_operand_pos() const { return operand_pos; }
+  Value *get_v() const { return v; }
+  StoreInst *get_store_inst() const { return store; }
+  LoadInst *get_init_load() const { return init; }
+};
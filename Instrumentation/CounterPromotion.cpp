@@ -0,0 +1,175 @@
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+
+#include "CounterPromotion.h"
+#include "InlineCounters.h"
+#include "../Support/Compat.h"
+
+#define DEBUG_TYPE "CounterPromotion"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<bool> PromoteCounters("phoenix-promote-counters",
+                              cl::desc("Keep inline counters in registers inside loops"),
+                              cl::init(true));
+
+static cl::opt<unsigned> MaxPromotionsPerLoop(
+    "phoenix-max-promotions-per-loop",
+    cl::desc("Max. number of counters kept in registers in a single loop"),
+    cl::init(20));
+
+typedef std::pair<LoadInst *, StoreInst *> CounterUpdate;
+
+// Rewrites one counter update inside a loop. See InstrProfiling.cpp, which
+// does the same for the -fprofile-instr-generate counters.
+class CounterPromoterHelper : public LoadAndStorePromoter {
+ private:
+  StoreInst *Store;
+  ArrayRef<BasicBlock *> ExitBlocks;
+  SmallVectorImpl<CounterUpdate> &Flushes;
+  SSAUpdater &SSA;
+
+ public:
+  CounterPromoterHelper(LoadInst *L,
+                        StoreInst *S,
+                        SSAUpdater &SSA,
+                        BasicBlock *Preheader,
+                        ArrayRef<BasicBlock *> ExitBlocks,
+                        SmallVectorImpl<CounterUpdate> &Flushes)
+      : LoadAndStorePromoter({L, S}, SSA),
+        Store(S),
+        ExitBlocks(ExitBlocks),
+        Flushes(Flushes),
+        SSA(SSA) {
+    // The counter starts at zero when the loop is entered
+    SSA.AddAvailableValue(Preheader, ConstantInt::get(L->getType(), 0));
+  }
+
+#if LLVM_VERSION_MAJOR >= 9
+  void doExtraRewritesBeforeFinalDeletion() override {
+#else
+  void doExtraRewritesBeforeFinalDeletion() const override {
+#endif
+    Value *ptr = Store->getPointerOperand();
+
+    for (BasicBlock *ExitBlock : ExitBlocks) {
+      Value *live_out = SSA.GetValueInMiddleOfBlock(ExitBlock);
+
+      IRBuilder<> Builder(&*ExitBlock->getFirstInsertionPt());
+      LoadInst *old = Builder.CreateLoad(live_out->getType(), ptr, "phoenix.cnt.promoted");
+      Value *add = Builder.CreateAdd(old, live_out, "phoenix.cnt.inc");
+      StoreInst *store = Builder.CreateStore(add, ptr);
+
+      // candidate for the parent loop
+      Flushes.push_back(std::make_pair(old, store));
+    }
+  }
+};
+
+static bool points_to(Value *ptr, GlobalVariable *counters) {
+  if (ConstantExpr *CE = dyn_cast<ConstantExpr>(ptr))
+    return CE->getOpcode() == Instruction::GetElementPtr && CE->getOperand(0) == counters;
+  return false;
+}
+
+// Finds `store (add (load @cnt), %x), @cnt` where @cnt is one of @counters
+static SmallVector<CounterUpdate, 16> find_updates(Function &F, GlobalVariable *counters) {
+  SmallVector<CounterUpdate, 16> updates;
+
+  for (BasicBlock &BB : F) {
+    for (Instruction &I : BB) {
+      StoreInst *store = dyn_cast<StoreInst>(&I);
+      if (!store || !points_to(store->getPointerOperand(), counters))
+        continue;
+
+      BinaryOperator *add = dyn_cast<BinaryOperator>(store->getValueOperand());
+      if (!add || add->getOpcode() != Instruction::Add)
+        continue;
+
+      LoadInst *load = dyn_cast<LoadInst>(add->getOperand(0));
+      if (!load || load->getPointerOperand() != store->getPointerOperand())
+        continue;
+
+      updates.push_back(std::make_pair(load, store));
+    }
+  }
+
+  return updates;
+}
+
+static bool can_promote(Loop *L, SmallVectorImpl<BasicBlock *> &ExitBlocks) {
+  if (!L->getLoopPreheader() || !L->hasDedicatedExits())
+    return false;
+
+  L->getUniqueExitBlocks(ExitBlocks);
+  if (ExitBlocks.empty())
+    return false;
+
+  for (BasicBlock *ExitBlock : ExitBlocks)
+    if (ExitBlock->isEHPad())
+      return false;
+
+  return true;
+}
+
+unsigned promote_counters(Function &F, LoopInfo &LI, GlobalVariable *counters) {
+  if (!PromoteCounters || AtomicCounters)
+    return 0;
+
+  DenseMap<Loop *, SmallVector<CounterUpdate, 8>> candidates;
+  for (CounterUpdate &u : find_updates(F, counters))
+    if (Loop *L = LI.getLoopFor(u.second->getParent()))
+      candidates[L].push_back(u);
+
+  if (candidates.empty())
+    return 0;
+
+  unsigned promoted = 0;
+
+  // Innermost loops first, so that the flushes in the exit blocks can be
+  // promoted again in the parent loop
+  SmallVector<Loop *, 8> loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(loops)) {
+    auto it = candidates.find(L);
+    if (it == candidates.end())
+      continue;
+
+    SmallVector<BasicBlock *, 8> ExitBlocks;
+    if (!can_promote(L, ExitBlocks))
+      continue;
+
+    SmallVector<CounterUpdate, 8> updates = it->second;
+    SmallVector<CounterUpdate, 8> flushes;
+
+    unsigned n = 0;
+    for (CounterUpdate &u : updates) {
+      if (n++ >= MaxPromotionsPerLoop)
+        break;
+
+      SmallVector<Instruction *, 2> insts = {u.first, u.second};
+      SSAUpdater SSA;
+      CounterPromoterHelper helper(u.first, u.second, SSA, L->getLoopPreheader(), ExitBlocks,
+                                   flushes);
+      helper.run(insts);
+      promoted++;
+    }
+
+    for (CounterUpdate &f : flushes)
+      if (Loop *parent = LI.getLoopFor(f.second->getParent()))
+        candidates[parent].push_back(f);
+  }
+
+  LLVM_DEBUG(dbgs() << "[" << F.getName() << "] promoted " << promoted << " counters\n");
+  return promoted;
+}
+
+};  // namespace phoenix
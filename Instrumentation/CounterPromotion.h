@@ -0,0 +1,25 @@
+#pragma once
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+extern cl::opt<bool> PromoteCounters;
+
+// Keeps the inline counters of @counters in registers while inside a loop of
+// @F, and flushes them to memory in the loop exit blocks. Each increment
+//   %c = load @cnt ; %inc = add %c, %x ; store %inc, @cnt
+// inside a loop becomes a phi chain that starts at 0 in the preheader. The
+// exit blocks then do `@cnt += live_out`, and those updates are promoted
+// again to the enclosing loop, from the innermost loop to the outermost one.
+//
+// Counters are only read by the runtime at exit, so it doesn't matter that
+// memory is stale while the loop runs. Returns the number of promotions.
+unsigned promote_counters(Function &F, LoopInfo &LI, GlobalVariable *counters);
+
+};  // namespace phoenix
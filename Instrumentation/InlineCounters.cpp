@@ -0,0 +1,138 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToUsed
+
+#include "InlineCounters.h"
+#include "Sampling.h"
+#include "../Support/Compat.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<bool> UseInlineCounters(
+    "phoenix-inline-counters",
+    cl::desc("Increment per-module counter arrays inline instead of calling the Collect runtime"),
+    cl::init(false));
+
+cl::opt<bool> AtomicCounters("phoenix-atomic-counters",
+                             cl::desc("Use atomic increments on inline counters (multi-threaded)"),
+                             cl::init(false));
+
+InlineCounters::InlineCounters(Module *M, CounterKind kind, unsigned num_sites)
+    : M(M), kind(kind), num_sites(num_sites), info(num_sites, 0) {
+  auto *I64Ty = Type::getInt64Ty(M->getContext());
+  ArrayType *ATy = ArrayType::get(I64Ty, 2 * num_sites);
+
+  counters = new GlobalVariable(*M, ATy, false, GlobalValue::PrivateLinkage,
+                                Constant::getNullValue(ATy),
+                                kind == STORE_COUNTERS ? "__phoenix_store_cnts" : "__phoenix_arith_cnts");
+  counters->setSection("phoenix_cnts");
+  set_alignment(counters, 8);
+}
+
+void InlineCounters::set_info(unsigned site, uint8_t value) {
+  assert(site < num_sites && "site out of range");
+  info[site] = value;
+}
+
+void InlineCounters::increment(IRBuilder<> &Builder, Value *ptr, Value *inc) {
+  if (AtomicCounters) {
+    create_atomic_rmw(Builder, AtomicRMWInst::Add, ptr, inc, AtomicOrdering::Monotonic);
+    return;
+  }
+
+  LoadInst *load = Builder.CreateLoad(inc->getType(), ptr, "phoenix.cnt");
+  Value *add = Builder.CreateAdd(load, inc, "phoenix.cnt.inc");
+  Builder.CreateStore(add, ptr);
+}
+
+void InlineCounters::increment(IRBuilder<> &Builder, unsigned site, Value *hit) {
+  assert(site < num_sites && "site out of range");
+
+  // Both GEPs are constant expressions, which keep them loop invariant
+  Type *Ty = counters->getValueType();
+  Value *hits_ptr = Builder.CreateConstInBoundsGEP2_32(Ty, counters, 0, 2 * site);
+  Value *total_ptr = Builder.CreateConstInBoundsGEP2_32(Ty, counters, 0, 2 * site + 1);
+
+  // An <N x i1> @hit counts one execution per lane
+  if (hit->getType()->isVectorTy()) {
+    unsigned lanes = get_vector_num_elements(hit->getType());
+    Value *ext = Builder.CreateZExt(hit, get_vector_type(Builder.getInt64Ty(), lanes));
+    increment(Builder, hits_ptr, Builder.CreateAddReduce(ext));
+    increment(Builder, total_ptr, Builder.getInt64(lanes));
+    return;
+  }
+
+  increment(Builder, hits_ptr, Builder.CreateZExt(hit, Builder.getInt64Ty()));
+  increment(Builder, total_ptr, Builder.getInt64(1));
+}
+
+// Inline counters do not call the runtime, so nothing would pull it (and the
+// flush it registers at exit) out of the static library. Reference the
+// `__phoenix_runtime` symbol it defines from a hidden function instead
+static void add_runtime_user(Module &M) {
+  const StringRef name = "__phoenix_runtime_user";
+  if (M.getFunction(name))
+    return;
+
+  LLVMContext &Ctx = M.getContext();
+  auto *I32Ty = Type::getInt32Ty(Ctx);
+
+  GlobalVariable *runtime = M.getGlobalVariable("__phoenix_runtime");
+  if (!runtime)
+    runtime = new GlobalVariable(M, I32Ty, false, GlobalValue::ExternalLinkage, nullptr,
+                                 "__phoenix_runtime");
+
+  Function *user = Function::Create(FunctionType::get(I32Ty, false),
+                                    GlobalValue::LinkOnceODRLinkage, name, &M);
+  user->setVisibility(GlobalValue::HiddenVisibility);
+  user->addFnAttr(Attribute::NoInline);
+
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", user));
+  Builder.CreateRet(Builder.CreateLoad(I32Ty, runtime));
+
+  appendToUsed(M, {user});
+}
+
+void InlineCounters::finalize() {
+  if (num_sites == 0)
+    return;
+
+  LLVMContext &Ctx = M->getContext();
+  auto *I8Ty = Type::getInt8Ty(Ctx);
+  auto *I32Ty = Type::getInt32Ty(Ctx);
+  auto *I64Ty = Type::getInt64Ty(Ctx);
+
+  Constant *info_init = ConstantDataArray::get(Ctx, info);
+  auto *info_gv = new GlobalVariable(*M, info_init->getType(), true, GlobalValue::PrivateLinkage,
+                                     info_init, "__phoenix_info");
+
+  // struct phoenix_module_data
+  StructType *DataTy = StructType::get(
+      Ctx, {I64Ty, I32Ty, I32Ty, I64Ty->getPointerTo(), I8Ty->getPointerTo(), I32Ty});
+
+  Constant *fields[] = {
+      ConstantInt::get(I64Ty, get_module_hash(*M)),               // module_hash
+      ConstantInt::get(I32Ty, kind),                              // kind
+      ConstantInt::get(I32Ty, num_sites),                         // num_sites
+      ConstantExpr::getBitCast(counters, I64Ty->getPointerTo()),  // counters
+      ConstantExpr::getBitCast(info_gv, I8Ty->getPointerTo()),    // info
+      ConstantInt::get(I32Ty, SampleRate),                        // sample_rate
+  };
+
+  auto *data = new GlobalVariable(*M, DataTy, false, GlobalValue::PrivateLinkage,
+                                  ConstantStruct::get(DataTy, fields), "__phoenix_data");
+  data->setSection("phoenix_data");
+  set_alignment(data, 8);
+
+  // Nothing references the descriptor, keep it alive
+  appendToUsed(*M, {data});
+
+  add_runtime_user(*M);
+}
+
+};  // namespace phoenix
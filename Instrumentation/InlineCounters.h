@@ -0,0 +1,53 @@
+#pragma once
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <vector>
+
+#include "SiteHash.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+// Must match COUNTER_KIND in Collect/profile_format.h
+enum CounterKind { STORE_COUNTERS = 0, ARITH_COUNTERS = 1 };
+
+extern cl::opt<bool> UseInlineCounters;
+extern cl::opt<bool> AtomicCounters;
+
+// A per-module array with a pair {hits, total} for each instrumented site.
+// The array lives in the `phoenix_cnts` section and is described by a
+// `phoenix_module_data` record in the `phoenix_data` section, which is how
+// the Collect runtime finds it at exit (see Collect/collect.h).
+class InlineCounters {
+ private:
+  Module *M;
+  CounterKind kind;
+  unsigned num_sites;
+  GlobalVariable *counters;
+
+  // is_marked for stores, the opcode for arithmetic instructions
+  std::vector<uint8_t> info;
+
+  void increment(IRBuilder<> &Builder, Value *ptr, Value *inc);
+
+ public:
+  InlineCounters(Module *M, CounterKind kind, unsigned num_sites);
+
+  GlobalVariable *get_counters() const { return counters; }
+  unsigned get_num_sites() const { return num_sites; }
+
+  void set_info(unsigned site, uint8_t value);
+
+  // Emits `hits += zext(@hit); total += 1` for @site at the insertion point.
+  // A vector @hit adds one execution per lane
+  void increment(IRBuilder<> &Builder, unsigned site, Value *hit);
+
+  // Emits the module descriptor. Call it after every site was instrumented
+  void finalize();
+};
+
+};  // namespace phoenix
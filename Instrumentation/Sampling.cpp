@@ -0,0 +1,86 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"  // appendToGlobalCtors
+
+#include "Sampling.h"
+#include "../Support/Compat.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<unsigned> SampleRate(
+    "phoenix-sample-rate",
+    cl::desc("Profile one out of every N executions of each site (1 = no sampling)"),
+    cl::init(1));
+
+cl::opt<unsigned> SampleBurst("phoenix-sample-burst",
+                              cl::desc("Number of consecutive executions profiled in a burst"),
+                              cl::init(100));
+
+bool sampling_enabled() {
+  return SampleRate > 1;
+}
+
+static GlobalVariable *get_sample_clock(Module *M) {
+  const StringRef name = "__phoenix_sample_clock";
+  if (GlobalVariable *clock = M->getGlobalVariable(name, true))
+    return clock;
+
+  auto *I32Ty = Type::getInt32Ty(M->getContext());
+  return new GlobalVariable(*M, I32Ty, false, GlobalValue::InternalLinkage,
+                            ConstantInt::get(I32Ty, 0), name, nullptr,
+                            GlobalValue::GeneralDynamicTLSModel);
+}
+
+Instruction *sample_before(Instruction *I) {
+  if (!sampling_enabled())
+    return I;
+
+  unsigned burst = SampleBurst;
+  unsigned period = burst * SampleRate;
+
+  GlobalVariable *clock = get_sample_clock(I->getModule());
+
+  IRBuilder<> Builder(I);
+  LoadInst *c = Builder.CreateLoad(clock->getValueType(), clock, "phoenix.clock");
+  Value *next = Builder.CreateAdd(c, Builder.getInt32(1), "phoenix.clock.next");
+  Value *wrap = Builder.CreateICmpEQ(next, Builder.getInt32(period));
+  Builder.CreateStore(Builder.CreateSelect(wrap, Builder.getInt32(0), next), clock);
+
+  Value *in_burst = Builder.CreateICmpULT(c, Builder.getInt32(burst), "phoenix.in_burst");
+
+  MDNode *weights = MDBuilder(I->getContext()).createBranchWeights(burst, period - burst);
+  Instruction *then = SplitBlockAndInsertIfThen(in_burst, I, false, weights);
+  then->getParent()->setName("phoenix.sample");
+
+  return then;
+}
+
+void insert_sample_rate_ctor(Module &M) {
+  if (!sampling_enabled() || M.getFunction("phoenix.set_sample_rate"))
+    return;
+
+  LLVMContext &Ctx = M.getContext();
+
+  Function *ctor = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                    GlobalValue::InternalLinkage, "phoenix.set_sample_rate", &M);
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", ctor));
+
+  Constant *const_function = phoenix::get_or_insert_function(
+      &M, "set_sample_rate", FunctionType::getVoidTy(Ctx), Type::getInt32Ty(Ctx));  // rate
+
+  Function *f = cast<Function>(const_function);
+
+  Builder.CreateCall(f, {Builder.getInt32(SampleRate)});
+  Builder.CreateRetVoid();
+
+  appendToGlobalCtors(M, ctor, 0);
+}
+
+};  // namespace phoenix
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+extern cl::opt<unsigned> SampleRate;
+extern cl::opt<unsigned> SampleBurst;
+
+bool sampling_enabled();
+
+// Burst sampling: each thread has a clock that ticks on every instrumented
+// site. The first `burst` ticks of a period of `burst x rate` ticks are
+// profiled, the remaining ones are skipped.
+//
+//   %c = load @__phoenix_sample_clock
+//   store (%c + 1 == period ? 0 : %c + 1), @__phoenix_sample_clock
+//   br (%c < burst), %sample, %I
+//
+// Returns the point where the profiling code must be inserted (the
+// terminator of %sample). Without sampling, @I itself is returned.
+Instruction *sample_before(Instruction *I);
+
+// Tells the runtime the sample rate, so that it can scale the counts back.
+// Only needed when the counters are kept by the runtime (call mode)
+void insert_sample_rate_ctor(Module &M);
+
+};  // namespace phoenix
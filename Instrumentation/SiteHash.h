@@ -0,0 +1,132 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using namespace llvm;
+
+// Header only, with no options: the DAG hashes sites and modules the same way
+// as the counting passes without linking their instrumentation
+
+namespace phoenix {
+
+// Hash of the module source file name. Site ids are only unique within a
+// module, so the runtime reports them as (module_hash, id)
+inline uint64_t get_module_hash(const Module &M) {
+  StringRef name = M.getSourceFileName();
+  if (name.empty())
+    name = M.getModuleIdentifier();
+  return MD5Hash(name);
+}
+
+inline void get_location(const Instruction *I, unsigned &line, unsigned &column,
+                         StringRef &file) {
+  const DebugLoc &loc = I->getDebugLoc();
+  if (!loc) {
+    line = column = 0;
+    file = "";
+    return;
+  }
+  line = loc.getLine();
+  column = loc.getCol();
+  file = cast<DIScope>(loc.getScope())->getFilename();
+}
+
+// The stable site hash of an instruction: a hash of the function name, the
+// debug location and the opcode, plus its ordinal among the instructions of
+// the function with the same location and opcode (see SiteIds.h)
+class SiteHasher {
+ private:
+  // Ordinal of each instruction, computed once per function
+  DenseMap<const Function *, DenseMap<const Instruction *, unsigned>> ordinals;
+
+ public:
+  unsigned get_ordinal(const Instruction *I) {
+    const Function *F = I->getFunction();
+    auto it = ordinals.find(F);
+
+    if (it == ordinals.end()) {
+      DenseMap<const Instruction *, unsigned> &ordinal = ordinals[F];
+      std::map<std::tuple<unsigned, unsigned, unsigned>, unsigned> seen;
+
+      for (const Instruction &inst : instructions(F)) {
+        unsigned line, column;
+        StringRef file;
+        get_location(&inst, line, column, file);
+        ordinal[&inst] = seen[std::make_tuple(line, column, inst.getOpcode())]++;
+      }
+      it = ordinals.find(F);
+    }
+
+    return it->second.lookup(I);
+  }
+
+  uint64_t get_site_hash(const Instruction *I) {
+    unsigned line, column;
+    StringRef file;
+    get_location(I, line, column, file);
+
+    std::string key;
+    raw_string_ostream rso(key);
+    rso << I->getFunction()->getName() << '\0' << file << '\0' << line << '\0' << column << '\0'
+        << I->getOpcodeName() << '\0' << get_ordinal(I);
+
+    return MD5Hash(rso.str());
+  }
+};
+
+// The site map of the @kind ("store" or "arith") sites of the module
+// @module_hash in the directory @dir
+inline std::string get_site_map_path(StringRef dir, uint64_t module_hash, StringRef kind) {
+  SmallString<128> path(dir);
+  sys::path::append(path, utohexstr(module_hash, true) + "." + kind + ".sites");
+  return path.str().str();
+}
+
+struct SiteMapEntry {
+  uint64_t module_hash;
+  unsigned id;
+  uint64_t site;
+};
+
+// Reads the entries of a site map written by SiteMap::write. Returns false
+// if @filename could not be read
+inline bool read_site_map(const std::string &filename, std::vector<SiteMapEntry> &entries) {
+  auto buf = MemoryBuffer::getFile(filename);
+  if (!buf)
+    return false;
+
+  SmallVector<StringRef, 16> lines;
+  (*buf)->getBuffer().split(lines, '\n', -1, false);
+
+  // The first line is the header
+  for (unsigned i = 1; i < lines.size(); i++) {
+    SmallVector<StringRef, 9> fields;
+    lines[i].split(fields, ',');
+
+    SiteMapEntry e;
+    if (fields.size() < 3 || fields[0].getAsInteger(16, e.module_hash) ||
+        fields[1].getAsInteger(10, e.id) || fields[2].getAsInteger(16, e.site))
+      continue;
+    entries.push_back(e);
+  }
+
+  return true;
+}
+
+};  // namespace phoenix
@@ -0,0 +1,60 @@
+#include "llvm/IR/Function.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "SiteIds.h"
+#include "../Support/Compat.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+cl::opt<std::string> SiteMapDir(
+    "phoenix-site-map",
+    cl::desc("Directory where to write the site maps, <module hash>.<store|arith>.sites"),
+    cl::value_desc("dir"));
+
+uint64_t SiteMap::add(unsigned id, const Instruction *I) {
+  Site site;
+  StringRef file;
+  site.id = id;
+  site.hash = get_site_hash(I);
+  site.opcode = I->getOpcodeName();
+  site.ordinal = hasher.get_ordinal(I);
+  get_location(I, site.line, site.column, file);
+  site.function = I->getFunction()->getName().str();
+  site.file = file.str();
+
+  sites.push_back(site);
+  return site.hash;
+}
+
+void SiteMap::write(const Module &M, CounterKind kind) {
+  if (SiteMapDir.empty())
+    return;
+
+  uint64_t module_hash = get_module_hash(M);
+  std::string filename =
+      get_site_map_path(SiteMapDir, module_hash, kind == STORE_COUNTERS ? "store" : "arith");
+
+  std::error_code EC = sys::fs::create_directories(SiteMapDir);
+  if (EC) {
+    errs() << "phoenix: could not create " << SiteMapDir << ": " << EC.message() << "\n";
+    return;
+  }
+
+  raw_fd_ostream out(filename, EC, phoenix::OF_Text);
+  if (EC) {
+    errs() << "phoenix: could not write the site map " << filename << ": " << EC.message() << "\n";
+    return;
+  }
+
+  out << "module,id,site,opcode,ordinal,line,column,function,file\n";
+  for (const Site &s : sites)
+    out << format_hex_no_prefix(module_hash, 1) << "," << s.id << ","
+        << format_hex_no_prefix(s.hash, 16) << "," << s.opcode << "," << s.ordinal << ","
+        << s.line << "," << s.column << "," << s.function << "," << s.file << "\n";
+}
+
+};  // namespace phoenix
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+
+#include <string>
+#include <vector>
+
+#include "InlineCounters.h"
+#include "SiteHash.h"
+
+using namespace llvm;
+
+namespace phoenix {
+
+extern cl::opt<std::string> SiteMapDir;
+
+// The ids given to the runtime index its tables, so they are dense and
+// change with the code around them. Each id is also given a stable site
+// hash: a hash of the function name, the debug location and the opcode of
+// the instruction, plus its ordinal among the instructions of the function
+// with the same location and opcode. With -phoenix-site-map=<dir>, the site
+// hashes of a module are written to a sidecar file at compile time (the site
+// map), one per module and kind of counter:
+//
+//   module,id,site,opcode,ordinal,line,column,function,file
+//
+// A profile of one build can then be matched with the sites of the next one
+// through the site hashes, see DAG/profile.cpp
+class SiteMap {
+ private:
+  struct Site {
+    unsigned id;
+    uint64_t hash;
+    const char *opcode;
+    unsigned ordinal, line, column;
+    std::string function, file;
+  };
+
+  std::vector<Site> sites;
+  SiteHasher hasher;
+
+ public:
+  // Call it before the instrumentation adds code around @I, which changes
+  // the ordinals
+  uint64_t add(unsigned id, const Instruction *I);
+
+  uint64_t get_site_hash(const Instruction *I) { return hasher.get_site_hash(I); }
+
+  // Writes the site map of @M to <-phoenix-site-map>/<module hash>.<store|arith>.sites,
+  // nothing if the option is not given
+  void write(const Module &M, CounterKind kind);
+};
+
+};  // namespace phoenix
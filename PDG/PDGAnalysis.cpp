@@ -60,7 +60,7 @@ void ProgramDependenceGraph::create_control_edges(BasicBlock *Y, Value *pred) {
     return;
 
   for (Value &y : *Y) {
-    if (!isa<TerminatorInst>(y))
+    if (!cast<Instruction>(y).isTerminator())
       DG->add_edge(&y, pred, DT_Control);
   }
 }
@@ -0,0 +1,271 @@
+// phoenix-profdata: merges and exports the binary profiles written by the
+// Collect runtime (see Collect/profile_format.h).
+//
+//   phoenix-profdata merge -o <output> <input>...
+//   phoenix-profdata show [-kind=store|arith|values] <input>
+//
+// `merge` sums the counters of several runs (or processes) into one profile.
+// `show` prints a profile using the same text format as store.txt and
+// values.txt. Arith counters get one row per instruction, where arith.txt
+// only has the sums per opcode
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../Collect/profile_format.h"
+
+struct ModuleProfile {
+  uint64_t module_hash;
+  uint32_t kind;
+  uint32_t sample_rate;
+  std::vector<uint8_t> info;
+  std::vector<uint64_t> counters;  // counters_per_site for each site
+
+  uint32_t num_sites() const { return info.size(); }
+};
+
+// Profiles are indexed by (kind, module_hash)
+typedef std::pair<uint32_t, uint64_t> ModuleKey;
+typedef std::map<ModuleKey, ModuleProfile> Profile;
+
+static void fail(const std::string &msg) {
+  std::cerr << "phoenix-profdata: " << msg << "\n";
+  exit(1);
+}
+
+static std::vector<uint8_t> read_file(const std::string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  if (!in)
+    fail("could not open " + filename);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static std::vector<ModuleProfile> read_profile(const std::string &filename) {
+  std::vector<uint8_t> buf = read_file(filename);
+  const uint8_t *begin = buf.data();
+
+  phoenix_prof_header h;
+  if (buf.size() < sizeof(h))
+    fail(filename + ": truncated header");
+  memcpy(&h, begin, sizeof(h));
+  if (!phoenix_prof_check_header(&h))
+    fail(filename + ": not a phoenix profile (or unsupported version)");
+
+  size_t index_size = sizeof(h) + h.num_modules * sizeof(phoenix_prof_module);
+  if (buf.size() < index_size)
+    fail(filename + ": truncated index");
+
+  std::vector<ModuleProfile> modules;
+  for (uint32_t m = 0; m < h.num_modules; m++) {
+    phoenix_prof_module entry;
+    memcpy(&entry, begin + sizeof(h) + m * sizeof(entry), sizeof(entry));
+
+    if (entry.offset + entry.size > buf.size() || entry.size < entry.num_sites)
+      fail(filename + ": module payload out of bounds");
+    if (entry.counters_per_site != phoenix_prof_counters_per_site(entry.kind))
+      fail(filename + ": unexpected number of counters per site");
+
+    ModuleProfile mp;
+    mp.module_hash = entry.module_hash;
+    mp.kind = entry.kind;
+    mp.sample_rate = entry.sample_rate;
+
+    const uint8_t *p = begin + entry.offset;
+    const uint8_t *payload_end = p + entry.size;
+    mp.info.assign(p, p + entry.num_sites);
+    p += entry.num_sites;
+
+    mp.counters.resize(entry.counters_per_site * entry.num_sites);
+    for (uint64_t &c : mp.counters)
+      if (!phoenix_prof_decode(&p, payload_end, &c))
+        fail(filename + ": truncated counters");
+
+    modules.push_back(std::move(mp));
+  }
+
+  return modules;
+}
+
+static void write_profile(const std::string &filename, const Profile &profile) {
+  std::vector<uint8_t> buf(sizeof(phoenix_prof_header) +
+                           profile.size() * sizeof(phoenix_prof_module));
+
+  phoenix_prof_header h;
+  phoenix_prof_init_header(&h, profile.size());
+  memcpy(buf.data(), &h, sizeof(h));
+
+  unsigned m = 0;
+  for (const auto &it : profile) {
+    const ModuleProfile &mp = it.second;
+
+    phoenix_prof_module entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.module_hash = mp.module_hash;
+    entry.kind = mp.kind;
+    entry.num_sites = mp.num_sites();
+    entry.sample_rate = mp.sample_rate;
+    entry.counters_per_site = phoenix_prof_counters_per_site(mp.kind);
+    entry.offset = buf.size();
+
+    buf.insert(buf.end(), mp.info.begin(), mp.info.end());
+    for (uint64_t c : mp.counters) {
+      uint8_t varint[PHOENIX_PROF_MAX_VARINT];
+      buf.insert(buf.end(), varint, varint + phoenix_prof_encode(c, varint));
+    }
+
+    entry.size = buf.size() - entry.offset;
+    memcpy(buf.data() + sizeof(h) + m++ * sizeof(entry), &entry, sizeof(entry));
+  }
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out.write(reinterpret_cast<const char *>(buf.data()), buf.size()))
+    fail("could not write " + filename);
+}
+
+static void merge_module(Profile &profile, ModuleProfile &&mp, const std::string &filename) {
+  ModuleKey key(mp.kind, mp.module_hash);
+
+  auto it = profile.find(key);
+  if (it == profile.end()) {
+    profile.emplace(key, std::move(mp));
+    return;
+  }
+
+  ModuleProfile &dst = it->second;
+  if (dst.num_sites() != mp.num_sites())
+    fail(filename + ": module has a different number of sites, was it recompiled?");
+  if (dst.sample_rate != mp.sample_rate)
+    fail(filename + ": profiles were collected with different sample rates");
+
+  for (unsigned i = 0; i < mp.num_sites(); i++)
+    dst.info[i] |= mp.info[i];  // is_marked, the opcode or is_fp, which is the same
+
+  if (mp.kind == PHOENIX_VALUE_COUNTERS) {
+    unsigned cps = phoenix_prof_counters_per_site(mp.kind);
+    for (unsigned i = 0; i < mp.num_sites(); i++)
+      phoenix_prof_merge_values(&dst.counters[i * cps], &mp.counters[i * cps]);
+    return;
+  }
+
+  for (unsigned i = 0; i < mp.counters.size(); i++)
+    dst.counters[i] += mp.counters[i];
+}
+
+static void show_values(const Profile &profile) {
+  const unsigned cps = phoenix_prof_counters_per_site(PHOENIX_VALUE_COUNTERS);
+
+  printf("module,id,total,value,count\n");
+  for (const auto &it : profile) {
+    const ModuleProfile &mp = it.second;
+    if (mp.kind != PHOENIX_VALUE_COUNTERS)
+      continue;
+
+    for (unsigned i = 0; i < mp.num_sites(); i++)
+      phoenix_prof_print_values(stdout, mp.module_hash, i, mp.info[i], &mp.counters[i * cps],
+                                mp.sample_rate);
+  }
+  printf("\n");
+}
+
+// Same output as the `write_text_*` functions in Collect/collect.c, rows are
+// printed by the same functions of profile_format.h. Arith counters are the
+// exception, printed per instruction instead of per opcode
+static void show(const Profile &profile, uint32_t kind) {
+  if (kind == PHOENIX_VALUE_COUNTERS) {
+    show_values(profile);
+    return;
+  }
+
+  bool sampled = false, only_records = true;
+  for (const auto &it : profile) {
+    const ModuleProfile &mp = it.second;
+    if (mp.kind != kind)
+      continue;
+    sampled |= mp.sample_rate > 1;
+    only_records &= mp.module_hash == 0;
+  }
+
+  if (kind == PHOENIX_STORE_COUNTERS)
+    printf("%sid,marked,silent,total%s\n", only_records ? "" : "module,",
+           sampled ? ",silent_lo,silent_hi" : "");
+  else
+    printf("module,id,opcode,identity,total%s\n", sampled ? ",identity_lo,identity_hi" : "");
+
+  for (const auto &it : profile) {
+    const ModuleProfile &mp = it.second;
+    if (mp.kind != kind)
+      continue;
+
+    for (unsigned i = 0; i < mp.num_sites(); i++) {
+      if (kind != PHOENIX_STORE_COUNTERS || !only_records)
+        printf("%llx,", (unsigned long long)mp.module_hash);
+      printf("%u,%d,", i, mp.info[i]);
+      phoenix_prof_print_counts(stdout, mp.counters[2 * i], mp.counters[2 * i + 1], mp.sample_rate,
+                                sampled);
+      printf("\n");
+    }
+  }
+  printf("\n");
+}
+
+static void usage() {
+  std::cerr << "usage: phoenix-profdata merge -o <output> <input>...\n"
+            << "       phoenix-profdata show [-kind=store|arith|values] <input>\n";
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2)
+    usage();
+
+  std::string command = argv[1];
+  std::string output;
+  uint32_t kind = PHOENIX_STORE_COUNTERS;
+  std::vector<std::string> inputs;
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-o" && i + 1 < argc)
+      output = argv[++i];
+    else if (arg == "-kind=store")
+      kind = PHOENIX_STORE_COUNTERS;
+    else if (arg == "-kind=arith")
+      kind = PHOENIX_ARITH_COUNTERS;
+    else if (arg == "-kind=values")
+      kind = PHOENIX_VALUE_COUNTERS;
+    else if (!arg.empty() && arg[0] == '-')
+      usage();
+    else
+      inputs.push_back(arg);
+  }
+
+  if (inputs.empty())
+    usage();
+
+  Profile profile;
+  for (const std::string &filename : inputs)
+    for (ModuleProfile &mp : read_profile(filename))
+      merge_module(profile, std::move(mp), filename);
+
+  if (command == "merge") {
+    if (output.empty())
+      usage();
+    write_profile(output, profile);
+  } else if (command == "show") {
+    if (inputs.size() != 1)
+      usage();
+    show(profile, kind);
+  } else {
+    usage();
+  }
+
+  return 0;
+}
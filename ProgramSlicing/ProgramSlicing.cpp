@@ -136,7 +136,7 @@ Value* constant_to_value(Function *F, BasicBlock *BB, ConstantData *c){
   gv->setInitializer(c);
 
   IRBuilder<> Builder(BB->getFirstNonPHI());
-  Value *v = Builder.CreateLoad(gv);
+  Value *v = Builder.CreateLoad(gv->getValueType(), gv);
   return v;
 }
 
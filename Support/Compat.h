@@ -0,0 +1,175 @@
+#pragma once
+
+// The passes are written against LLVM 6.0.1, the version of the artifact (see
+// Dockerfile), and also build with LLVM 14. These wrap the APIs that changed
+// in between
+
+#include "llvm/Config/llvm-config.h"
+#if LLVM_VERSION_MAJOR >= 9
+#include "llvm/Analysis/IVDescriptors.h"
+#else
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#endif
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include <climits>
+
+#if LLVM_VERSION_MAJOR < 7
+#define LLVM_DEBUG(X) DEBUG(X)
+#endif
+
+using namespace llvm;
+
+namespace phoenix {
+
+#if LLVM_VERSION_MAJOR >= 9
+constexpr sys::fs::OpenFlags OF_Text = sys::fs::OF_Text;
+#else
+constexpr sys::fs::OpenFlags OF_Text = sys::fs::F_Text;
+#endif
+
+inline Constant *get_or_insert_function(Module *M, StringRef name, FunctionType *FTy) {
+#if LLVM_VERSION_MAJOR >= 9
+  return cast<Constant>(M->getOrInsertFunction(name, FTy).getCallee());
+#else
+  return M->getOrInsertFunction(name, FTy);
+#endif
+}
+
+template <typename... ArgsTy>
+inline Constant *get_or_insert_function(Module *M, StringRef name, Type *RetTy,
+                                        ArgsTy *... Args) {
+  return get_or_insert_function(M, name, FunctionType::get(RetTy, {Args...}, false));
+}
+
+// Number of lanes of the vector type @T
+inline unsigned get_vector_num_elements(Type *T) {
+#if LLVM_VERSION_MAJOR >= 11
+  return cast<FixedVectorType>(T)->getNumElements();
+#else
+  return T->getVectorNumElements();
+#endif
+}
+
+inline VectorType *get_vector_type(Type *Elt, unsigned lanes) {
+#if LLVM_VERSION_MAJOR >= 11
+  return FixedVectorType::get(Elt, lanes);
+#else
+  return VectorType::get(Elt, lanes);
+#endif
+}
+
+// @I is a LoadInst, StoreInst or GlobalVariable
+template <typename T>
+inline void set_alignment(T *I, unsigned align) {
+#if LLVM_VERSION_MAJOR >= 11
+  I->setAlignment(Align(align));
+#else
+  I->setAlignment(align);
+#endif
+}
+
+inline AtomicRMWInst *create_atomic_rmw(IRBuilder<> &Builder, AtomicRMWInst::BinOp op,
+                                        Value *ptr, Value *v, AtomicOrdering ordering) {
+#if LLVM_VERSION_MAJOR >= 13
+  return Builder.CreateAtomicRMW(op, ptr, v, MaybeAlign(), ordering);
+#else
+  return Builder.CreateAtomicRMW(op, ptr, v, ordering);
+#endif
+}
+
+// TTI costs are ints up to LLVM 11. An invalid cost (the target cannot
+// lower the instruction) is INT_MAX
+#if LLVM_VERSION_MAJOR >= 12
+inline int get_cost_value(InstructionCost cost) {
+  return cost.isValid() ? *cost.getValue() : INT_MAX;
+}
+#else
+inline int get_cost_value(int cost) {
+  return cost;
+}
+#endif
+
+inline int get_instruction_cost(TargetTransformInfo &TTI, Instruction *I) {
+  return get_cost_value(TTI.getInstructionCost(I, TargetTransformInfo::TCK_RecipThroughput));
+}
+
+// Cost of comparing two values of type @Ty (@opcode is ICmp or FCmp)
+inline int get_cmp_cost(TargetTransformInfo &TTI, unsigned opcode, Type *Ty) {
+#if LLVM_VERSION_MAJOR >= 12
+  Type *CondTy = CmpInst::makeCmpResultType(Ty);
+  return get_cost_value(TTI.getCmpSelInstrCost(opcode, Ty, CondTy, CmpInst::BAD_ICMP_PREDICATE));
+#else
+  return get_cost_value(TTI.getCmpSelInstrCost(opcode, Ty));
+#endif
+}
+
+inline int get_and_reduction_cost(TargetTransformInfo &TTI, VectorType *Ty) {
+#if LLVM_VERSION_MAJOR >= 14
+  return get_cost_value(TTI.getArithmeticReductionCost(Instruction::And, Ty, None));
+#else
+  return get_cost_value(TTI.getArithmeticReductionCost(Instruction::And, Ty, false));
+#endif
+}
+
+inline bool is_legal_masked_store(TargetTransformInfo &TTI, Type *Ty, unsigned align) {
+#if LLVM_VERSION_MAJOR >= 11
+  return TTI.isLegalMaskedStore(Ty, Align(align));
+#else
+  return TTI.isLegalMaskedStore(Ty);
+#endif
+}
+
+inline Instruction *create_masked_store(IRBuilder<> &Builder, Value *v, Value *ptr,
+                                       unsigned align, Value *mask) {
+#if LLVM_VERSION_MAJOR >= 11
+  return Builder.CreateMaskedStore(v, ptr, Align(align), mask);
+#else
+  return Builder.CreateMaskedStore(v, ptr, align, mask);
+#endif
+}
+
+// Kinds of reduction the DAG guards
+enum class ReductionKind { Add, Mul, FAdd, FMul, Other };
+
+inline ReductionKind get_reduction_kind(const RecurrenceDescriptor &RD) {
+#if LLVM_VERSION_MAJOR >= 12
+  switch (RD.getRecurrenceKind()) {
+  case RecurKind::Add: return ReductionKind::Add;
+  case RecurKind::Mul: return ReductionKind::Mul;
+  case RecurKind::FAdd: return ReductionKind::FAdd;
+  case RecurKind::FMul: return ReductionKind::FMul;
+  default: return ReductionKind::Other;
+  }
+#else
+  switch (RD.getRecurrenceKind()) {
+  case RecurrenceDescriptor::RK_IntegerAdd: return ReductionKind::Add;
+  case RecurrenceDescriptor::RK_IntegerMult: return ReductionKind::Mul;
+  case RecurrenceDescriptor::RK_FloatAdd: return ReductionKind::FAdd;
+  case RecurrenceDescriptor::RK_FloatMult: return ReductionKind::FMul;
+  default: return ReductionKind::Other;
+  }
+#endif
+}
+
+// Clones the body of @F into @NewF, in the same module
+inline void clone_function_into(Function *NewF, Function *F, ValueToValueMapTy &VMap,
+                                SmallVectorImpl<ReturnInst *> &Returns, const char *suffix) {
+#if LLVM_VERSION_MAJOR >= 13
+  CloneFunctionInto(NewF, F, VMap,
+                    F->getSubprogram() ? CloneFunctionChangeType::GlobalChanges
+                                       : CloneFunctionChangeType::LocalChangesOnly,
+                    Returns, suffix, nullptr);
+#else
+  CloneFunctionInto(NewF, F, VMap, F->getSubprogram() != nullptr, Returns, suffix, nullptr);
+#endif
+}
+
+};  // end namespace phoenix
@@ -0,0 +1,38 @@
+// Records known counts through the Collect runtime, which writes the
+// profiles when the program exits (see profile.test)
+
+#include "../../Identify/Position.h"
+
+void init_records(unsigned total_static_stores);
+void record_store(unsigned store_id, unsigned is_marked, int is_equals);
+void init_arith(unsigned num_sites);
+void record_arith_i32_add(unsigned id, int a, int b, unsigned op_pos);
+void record_arith_f64_fmul(unsigned id, double a, double b, unsigned op_pos);
+void init_values(unsigned num_sites);
+void record_value(unsigned id, unsigned long long value, unsigned is_fp);
+
+int main(){
+  init_records(4);
+  init_arith(2);
+  init_values(1);
+
+  // store 0: 25 silent out of 100, store 3: always silent, 1 and 2 never run
+  for (int i = 0; i < 100; i++) {
+    record_store(0, 1, i < 25);
+    record_store(3, 0, 1);
+  }
+
+  // *p = *p + v with v == 0 half of the time, *p = *p * 1.0 always
+  for (int i = 0; i < 10; i++) {
+    record_arith_i32_add(0, 5, i % 2, FIRST);
+    record_arith_f64_fmul(1, 3.0, 1.0, FIRST);
+  }
+
+  for (int i = 0; i < 4; i++)
+    record_value(0, i < 3 ? 7 : 9, 0);
+
+  // Not announced by init_arith: the shard grows
+  record_arith_i32_add(20, 0, 5, SECOND);
+
+  return 0;
+}
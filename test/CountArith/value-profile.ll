@@ -0,0 +1,46 @@
+; With -phoenix-value-profile, the value histogram and the arith counters of a
+; site are recorded in the same sampled region: one tick of the clock and one
+; a * b per execution of the site
+
+; RUN: %opt %countarith -phoenix-value-profile -phoenix-sample-rate=10 -S %s | %FileCheck %s --check-prefixes=CHECK,CALL
+; RUN: %opt %countarith -phoenix-value-profile -phoenix-inline-counters -phoenix-sample-rate=10 -S %s | %FileCheck %s --check-prefixes=CHECK,INLINE
+
+; CHECK-LABEL: @fma(
+; CHECK:       %phoenix.clock = load i32, i32* @__phoenix_sample_clock
+; CHECK-NOT:   load i32, i32* @__phoenix_sample_clock
+; CHECK:       br i1 %phoenix.in_burst, label %phoenix.sample
+; CHECK:       phoenix.sample:
+; CHECK-NEXT:  %phoenix.fmul = fmul double %x, %y
+; CHECK-NOT:   = fmul
+; CHECK:       call void @record_value(i32 0,
+; CALL-NEXT:   call void @record_arith_f64_fadd(i32 0, double %phoenix.fmul, double %old, i32 2)
+; INLINE-NEXT: fcmp oeq double %phoenix.fmul, 0.000000e+00
+; CHECK-NOT:   load i32, i32* @__phoenix_sample_clock
+; CHECK:       store double %new, double* %pp
+; CHECK-NOT:   load i32, i32* @__phoenix_sample_clock
+; CHECK:       ret void
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @fma(double* %p, double* %a, double* %b, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr double, double* %a, i32 %i
+  %pb = getelementptr double, double* %b, i32 %i
+  %pp = getelementptr double, double* %p, i32 %i
+  %x = load double, double* %pa
+  %y = load double, double* %pb
+  %old = load double, double* %pp
+  %new = call double @llvm.fmuladd.f64(double %x, double %y, double %old)
+  store double %new, double* %pp
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+declare double @llvm.fmuladd.f64(double, double, double)
@@ -0,0 +1,86 @@
+; A monotonic or acquire atomicrmw whose operand is its identity is a load.
+; Other operands are only guarded in loops, when the cost model expects the
+; guard to pay off. Stronger orderings are kept
+
+; RUN: %opt %dag -S %s | %FileCheck %s --check-prefixes=CHECK,DEFAULT
+; RUN: %opt %dag -phoenix-identity-rate=1 -phoenix-store-savings=20 -S %s | %FileCheck %s --check-prefixes=CHECK,GUARD
+; RUN: %opt %dag -dag-atomics=false -S %s | %FileCheck %s --check-prefix=OFF
+
+target triple = "x86_64-unknown-linux-gnu"
+
+; OFF-NOT: phoenix.atomic
+
+; CHECK-LABEL:  @count(
+; DEFAULT-NOT:  phoenix.atomic
+; DEFAULT:      %old = atomicrmw add i32* %p, i32 %x monotonic
+; GUARD:        %[[G:[0-9]+]] = icmp eq i32 %x, 0
+; GUARD-NEXT:   br i1 %[[G]], label %[[SKIP:[0-9]+]], label %[[RMW:[0-9]+]]
+; GUARD:        [[SKIP]]:
+; GUARD-NEXT:   %phoenix.atomic = load atomic i32, i32* %p monotonic
+; GUARD:        [[RMW]]:
+; GUARD-NEXT:   %old = atomicrmw add i32* %p, i32 %x monotonic
+define void @count(i32* %p, i32* %a, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %x = load i32, i32* %pa
+  %old = atomicrmw add i32* %p, i32 %x monotonic
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+; Not in a loop, never guarded
+; CHECK-LABEL: @once(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:  %old = atomicrmw add i32* %p, i32 %x monotonic
+; CHECK-NEXT:  ret void
+define void @once(i32* %p, i32 %x) {
+entry:
+  %old = atomicrmw add i32* %p, i32 %x monotonic
+  ret void
+}
+
+; CHECK-LABEL: @peek(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:  %phoenix.atomic = load atomic i32, i32* %p acquire
+; CHECK-NEXT:  ret i32 %phoenix.atomic
+define i32 @peek(i32* %p) {
+entry:
+  %old = atomicrmw or i32* %p, i32 0 acquire
+  ret i32 %old
+}
+
+; A seq_cst RMW is not a fence and a load: it still writes, and reads the
+; latest value of *p
+; CHECK-LABEL: @peek_seq_cst(
+; CHECK-NEXT:  entry:
+; CHECK-NEXT:  %old = atomicrmw or i32* %p, i32 0 seq_cst
+; CHECK-NEXT:  ret i32 %old
+define i32 @peek_seq_cst(i32* %p) {
+entry:
+  %old = atomicrmw or i32* %p, i32 0 seq_cst
+  ret i32 %old
+}
+
+; CHECK-LABEL: @count_release(
+; CHECK-NOT:   phoenix.atomic
+; CHECK:       %old = atomicrmw add i32* %p, i32 %x release
+define void @count_release(i32* %p, i32* %a, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %x = load i32, i32* %pa
+  %old = atomicrmw add i32* %p, i32 %x release
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
@@ -0,0 +1,95 @@
+; Branchless stores: the store is kept and writes to a scratch slot when
+; silent, or is a masked store when the target has them
+
+; RUN: %opt %dag -dag-opt=branchless -S %s | %FileCheck %s
+; RUN: %opt %dag -dag-opt=branchless -mattr=+avx2 -S %s | %FileCheck %s --check-prefix=MASKED
+
+; A site (see CountStores -phoenix-site-map) selected under eae tests the
+; cheap node %t instead of the stored value
+; RUN: %opt %dag -dag-opt=eae -dag-branchless-sites=de5071389666937e -S %s | %FileCheck %s --check-prefix=SITE
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: @scal(
+; CHECK:       %phoenix.scratch = alloca i32
+; CHECK:       %s = add i32 %x, %m
+; CHECK-NEXT:  %[[NE:[0-9]+]] = icmp ne i32 %s, %x
+; CHECK-NEXT:  %[[P:[0-9]+]] = select i1 %[[NE]], i32* %pa, i32* %phoenix.scratch
+; CHECK-NEXT:  store i32 %s, i32* %[[P]]
+; CHECK-NOT:   br i1 %[[NE]]
+define void @scal(i32* %a, i32* %b, i32* %c, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %pb = getelementptr i32, i32* %b, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %x = load i32, i32* %pa
+  %y = load i32, i32* %pb
+  %z = load i32, i32* %pc
+  %m = mul i32 %y, %z
+  %s = add i32 %x, %m
+  store i32 %s, i32* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
+
+; CHECK-LABEL: @vec(
+; CHECK:       %phoenix.scratch = alloca <4 x i32>
+; CHECK:       %[[NE:[0-9]+]] = icmp ne <4 x i32> %s, %x
+; CHECK-NEXT:  %[[ANY:[0-9]+]] = call i1 @llvm.vector.reduce.or.v4i1(<4 x i1> %[[NE]])
+; CHECK-NEXT:  %[[P:[0-9]+]] = select i1 %[[ANY]], <4 x i32>* %pa, <4 x i32>* %phoenix.scratch
+; CHECK-NEXT:  store <4 x i32> %s, <4 x i32>* %[[P]]
+
+; MASKED-LABEL: @vec(
+; MASKED-NOT:   phoenix.scratch
+; MASKED:       %[[NE:[0-9]+]] = icmp ne <4 x i32> %s, %x
+; MASKED-NEXT:  call void @llvm.masked.store.v4i32.p0v4i32(<4 x i32> %s, <4 x i32>* %pa, i32 16, <4 x i1> %[[NE]])
+define void @vec(<4 x i32>* %a, <4 x i32>* %b, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr <4 x i32>, <4 x i32>* %a, i32 %i
+  %pb = getelementptr <4 x i32>, <4 x i32>* %b, i32 %i
+  %x = load <4 x i32>, <4 x i32>* %pa
+  %y = load <4 x i32>, <4 x i32>* %pb
+  %s = add <4 x i32> %x, %y
+  store <4 x i32> %s, <4 x i32>* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
+
+; SITE-LABEL: @axpy(
+; SITE:       %phoenix.scratch = alloca i32
+; SITE:       %t = and i32 %i, 3
+; SITE:       %[[NE:[0-9]+]] = icmp ne i32 %t, 0
+; SITE-NEXT:  %[[P:[0-9]+]] = select i1 %[[NE]], i32* %pa, i32* %phoenix.scratch
+; SITE-NEXT:  store i32 %s, i32* %[[P]]
+define void @axpy(i32* %a, i32 %k, i32* %c, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %x = load i32, i32* %pa
+  %z = load i32, i32* %pc
+  %t = and i32 %i, 3
+  %m = mul i32 %t, %z
+  %s = add i32 %x, %m
+  store i32 %s, i32* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
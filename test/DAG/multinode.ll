@@ -0,0 +1,46 @@
+; Under eae every node of the DAG that may be zero gets a guard, cheapest
+; first. A guard nested in another must still pay for its compare at the
+; identity rate, given the outer one already passed
+
+; RUN: %opt %dag -dag-opt=eae -S %s | %FileCheck %s
+; RUN: %opt %dag -dag-opt=eae -phoenix-identity-rate=0.27 -S %s | %FileCheck %s --check-prefix=ONE
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: @axpy(
+; CHECK:       %z = load i32, i32* %pc
+; CHECK-NEXT:  %[[G1:[0-9]+]] = icmp ne i32 %z, 0
+; CHECK-NEXT:  br i1 %[[G1]], label %[[B1:[0-9]+]], label
+; CHECK:       [[B1]]:
+; CHECK-NEXT:  %m = mul i32 %k, %z
+; CHECK-NEXT:  %[[G2:[0-9]+]] = icmp ne i32 %m, 0
+; CHECK-NEXT:  br i1 %[[G2]], label %[[B2:[0-9]+]], label
+; CHECK:       [[B2]]:
+; CHECK:       store i32 %s, i32* %pa
+
+; ONE-LABEL: @axpy(
+; ONE:       %[[G1:[0-9]+]] = icmp ne i32 %z, 0
+; ONE-NEXT:  br i1 %[[G1]], label %[[B1:[0-9]+]], label
+; ONE:       [[B1]]:
+; ONE:       %m = mul i32 %k, %z
+; ONE-NOT:   icmp ne i32 %m, 0
+; ONE:       store i32 %s, i32* %pa
+define void @axpy(i32* %a, i32 %k, i32* %c, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %x = load i32, i32* %pa
+  %z = load i32, i32* %pc
+  %m = mul i32 %k, %z
+  %s = add i32 %x, %m
+  store i32 %s, i32* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
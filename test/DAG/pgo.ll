@@ -0,0 +1,82 @@
+; -dag-opt=pgo with the profiles of an instrumented run. v = k * c[i] is 0
+; for 900 of the 1000 updates. An arith profile gives the guard on v, as the
+; outermost guard of eae; a store profile the silent store guard, as ess
+
+; RUN: %opt %countarith -phoenix-inline-counters -phoenix-site-map=maps %s -o arith.bc
+; RUN: %llc -relocation-model=pic -filetype=obj arith.bc -o arith.o
+; RUN: %cc arith.o %collect -o arith && PHOENIX_PROFILE_FORMAT=binary ./arith
+; RUN: %opt %countstores -phoenix-inline-counters -phoenix-site-map=maps %s -o store.bc
+; RUN: %llc -relocation-model=pic -filetype=obj store.bc -o store.o
+; RUN: %cc store.o %collect -o store && PHOENIX_PROFILE_FORMAT=binary ./store
+
+; RUN: %opt %dag -dag-opt=pgo -phoenix-profile=arith.profraw -phoenix-profile-sites=maps -S %s | %FileCheck %s --check-prefix=ARITH
+; RUN: %opt %dag -dag-opt=pgo -phoenix-profile=store.profraw -phoenix-profile-sites=maps -S %s | %FileCheck %s --check-prefix=STORE
+
+; The arith guard skips more, it wins when the profile has both
+; RUN: %profdata merge -o all.profraw store.profraw arith.profraw
+; RUN: %opt %dag -dag-opt=pgo -phoenix-profile=all.profraw -phoenix-profile-sites=maps -S %s | %FileCheck %s --check-prefix=ARITH
+
+; RUN: %opt %dag -dag-opt=pgo -phoenix-profile=all.profraw -phoenix-profile-sites=maps -phoenix-profile-threshold=0.95 -S %s | %FileCheck %s --check-prefix=NONE
+
+source_filename = "pgo.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@a = global [1000 x i32] zeroinitializer
+@c = global [1000 x i32] zeroinitializer
+
+; ARITH-LABEL: @axpy(
+; ARITH:       %m = mul i32 %k, %z
+; ARITH-NEXT:  %[[G:[0-9]+]] = icmp ne i32 %m, 0
+; ARITH-NEXT:  br i1 %[[G]], label %[[ST:[0-9]+]], label %{{[0-9]+}}, !prof ![[W:[0-9]+]]
+; ARITH:       [[ST]]:
+; ARITH-NEXT:  %pa = getelementptr i32, i32* %a, i32 %i
+; ARITH-NEXT:  %x = load i32, i32* %pa
+; ARITH:       ![[W]] = !{!"branch_weights", i32 100, i32 900}
+
+; STORE-LABEL: @axpy(
+; STORE:       %s = add i32 %x, %m
+; STORE-NEXT:  %[[G:[0-9]+]] = icmp ne i32 %s, %x
+; STORE-NEXT:  br i1 %[[G]], label %{{[0-9]+}}, label %{{[0-9]+}}, !prof ![[W:[0-9]+]]
+; STORE:       ![[W]] = !{!"branch_weights", i32 100, i32 900}
+
+; NONE-NOT: branch_weights
+define void @axpy(i32* %a, i32 %k, i32* %c, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %x = load i32, i32* %pa
+  %z = load i32, i32* %pc
+  %m = mul i32 %k, %z
+  %s = add i32 %x, %m
+  store i32 %s, i32* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
+
+; c[i] = (i % 10 == 0), so v = k * c[i] is 0 90% of the time
+define i32 @main() {
+entry:
+  br label %init
+init:
+  %i = phi i32 [0, %entry], [%i.next, %init]
+  %r = urem i32 %i, 10
+  %z = icmp eq i32 %r, 0
+  %v = zext i1 %z to i32
+  %pc = getelementptr [1000 x i32], [1000 x i32]* @c, i32 0, i32 %i
+  store i32 %v, i32* %pc
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, 1000
+  br i1 %cnd, label %init, label %run
+run:
+  %pa = getelementptr [1000 x i32], [1000 x i32]* @a, i32 0, i32 0
+  %pc0 = getelementptr [1000 x i32], [1000 x i32]* @c, i32 0, i32 0
+  call void @axpy(i32* %pa, i32 3, i32* %pc0, i32 1000)
+  ret i32 0
+}
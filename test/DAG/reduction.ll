@@ -0,0 +1,89 @@
+; Reductions are only guarded with -dag-reductions, and only when the cost
+; model expects the skipped fmul/fadd to pay for the compare
+
+; RUN: %opt %dag -S %s | %FileCheck %s --check-prefix=OFF
+; RUN: %opt %dag -dag-reductions -S %s | %FileCheck %s --check-prefix=OFF
+; RUN: %opt %dag -dag-reductions -phoenix-identity-rate=0.9 -S %s | %FileCheck %s
+
+target triple = "x86_64-unknown-linux-gnu"
+
+; OFF-LABEL: @dot(
+; OFF-NOT:   phoenix.acc
+
+; CHECK-LABEL: @dot(
+; CHECK:       %acc = phi double [ %init, %entry ], [ %phoenix.acc, %[[JOIN:[0-9]+]] ]
+; CHECK:       %[[G:[0-9]+]] = fcmp une double %x, 0.000000e+00
+; CHECK-NEXT:  br i1 %[[G]], label %[[BODY:[0-9]+]], label %[[JOIN]]
+; CHECK:       [[BODY]]:
+; CHECK-NEXT:  %m = fmul double %x, %y
+; CHECK-NEXT:  %new = fadd double %acc, %m
+; CHECK:       [[JOIN]]:
+; CHECK-NEXT:  %phoenix.acc = phi double [ %new, %[[BODY]] ], [ %acc, %loop ]
+
+; The write-back is skipped only if the bits are unchanged: NaN, or -0.0 from
+; +0.0, is stored
+; CHECK:       exit:
+; CHECK-NEXT:  %[[NEW:[0-9]+]] = bitcast double %phoenix.acc to i64
+; CHECK-NEXT:  %[[OLD:[0-9]+]] = bitcast double %init to i64
+; CHECK-NEXT:  %[[W:[0-9]+]] = icmp ne i64 %[[NEW]], %[[OLD]]
+; CHECK-NEXT:  br i1 %[[W]], label %[[ST:[0-9]+]], label
+; CHECK:       [[ST]]:
+; CHECK-NEXT:  store double %phoenix.acc, double* %p
+define void @dot(double* %p, double* %a, double* %b, i32 %n) {
+entry:
+  %init = load double, double* %p
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %acc = phi double [%init, %entry], [%new, %loop]
+  %pa = getelementptr double, double* %a, i32 %i
+  %pb = getelementptr double, double* %b, i32 %i
+  %x = load double, double* %pa
+  %y = load double, double* %pb
+  %m = fmul double %x, %y
+  %new = fadd double %acc, %m
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  store double %new, double* %p
+  ret void
+}
+
+; A guarded store in the block of the reduction: the reduction is guarded
+; once insert_if has split that block
+; CHECK-LABEL: @mix(
+; CHECK:       %acc = phi double [ %init, %entry ], [ %phoenix.acc, %split ]
+; CHECK:       %[[G:[0-9]+]] = fcmp une double %x, 0.000000e+00
+; CHECK-NEXT:  br i1 %[[G]], label %[[BODY:[0-9]+]], label %[[JOIN:[0-9]+]]
+; CHECK:       [[JOIN]]:
+; CHECK-NEXT:  %phoenix.acc = phi double [ %new, %[[BODY]] ], [ %acc, %split1 ]
+; CHECK:       %[[S:[0-9]+]] = icmp ne i32 %s, %u
+; CHECK-NEXT:  br i1 %[[S]]
+define void @mix(double* %p, double* %a, double* %b, i32* %q, i32* %c, i32 %n) {
+entry:
+  %init = load double, double* %p
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %acc = phi double [%init, %entry], [%new, %loop]
+  %pa = getelementptr double, double* %a, i32 %i
+  %pb = getelementptr double, double* %b, i32 %i
+  %x = load double, double* %pa
+  %y = load double, double* %pb
+  %m = fmul double %x, %y
+  %new = fadd double %acc, %m
+  %pq = getelementptr i32, i32* %q, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %u = load i32, i32* %pq
+  %w = load i32, i32* %pc
+  %v = mul i32 %w, %w
+  %s = add i32 %u, %v
+  store i32 %s, i32* %pq
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  store double %new, double* %p
+  ret void
+}
@@ -0,0 +1,45 @@
+; A vector store is silent when every lane is. With -dag-masked-store, and a
+; target that has them, only the lanes that changed are written
+
+; RUN: %opt %dag -dag-opt=ess -phoenix-identity-rate=0.9 -phoenix-store-savings=8 -S %s | %FileCheck %s
+; RUN: %opt %dag -dag-opt=ess -phoenix-identity-rate=0.9 -phoenix-store-savings=8 -dag-masked-store -mattr=+avx2 -S %s | %FileCheck %s --check-prefix=MASKED
+; RUN: %opt %dag -dag-opt=ess -S %s | %FileCheck %s --check-prefix=COST
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+; CHECK-LABEL: @vec(
+; CHECK:       %s = add <4 x i32> %x, %y
+; CHECK-NEXT:  %[[EQ:[0-9]+]] = icmp eq <4 x i32> %s, %x
+; CHECK-NEXT:  %[[ALL:[0-9]+]] = call i1 @llvm.vector.reduce.and.v4i1(<4 x i1> %[[EQ]])
+; CHECK-NEXT:  %[[NE:[0-9]+]] = xor i1 %[[ALL]], true
+; CHECK-NEXT:  br i1 %[[NE]], label %[[ST:[0-9]+]], label
+; CHECK:       [[ST]]:
+; CHECK-NEXT:  store <4 x i32> %s, <4 x i32>* %pa
+
+; MASKED-LABEL: @vec(
+; MASKED:       %[[NE:[0-9]+]] = icmp ne <4 x i32> %s, %x
+; MASKED-NEXT:  call void @llvm.masked.store.v4i32.p0v4i32(<4 x i32> %s, <4 x i32>* %pa, i32 16, <4 x i1> %[[NE]])
+; MASKED-NOT:   store <4 x i32>
+
+; The compare and the reduction cost more than an add and a store
+; COST-LABEL: @vec(
+; COST-NOT:   icmp eq <4 x i32>
+; COST:       store <4 x i32> %s, <4 x i32>* %pa
+define void @vec(<4 x i32>* %a, <4 x i32>* %b, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr <4 x i32>, <4 x i32>* %a, i32 %i
+  %pb = getelementptr <4 x i32>, <4 x i32>* %b, i32 %i
+  %x = load <4 x i32>, <4 x i32>* %pa
+  %y = load <4 x i32>, <4 x i32>* %pb
+  %s = add <4 x i32> %x, %y
+  store <4 x i32> %s, <4 x i32>* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
@@ -0,0 +1,42 @@
+; The site maps are only written with -phoenix-site-map, one file per module
+; and kind of counter, so CountStores and CountArith do not overwrite each
+; other
+
+; RUN: %opt %countstores -S %s -o /dev/null
+; RUN: %opt %countarith -S %s -o /dev/null
+; RUN: test -z "$(ls)"
+
+; RUN: %opt %countstores -phoenix-site-map=maps -S %s -o /dev/null
+; RUN: %opt %countarith -phoenix-site-map=maps -S %s -o /dev/null
+; RUN: %FileCheck %s --check-prefix=STORE < maps/*.store.sites
+; RUN: %FileCheck %s --check-prefix=ARITH < maps/*.arith.sites
+
+; STORE:      module,id,site,opcode,ordinal,line,column,function,file
+; STORE-NEXT: {{[0-9a-f]+}},0,{{[0-9a-f]+}},store,0,0,0,axpy,
+; STORE-NOT:  ,add,
+
+; ARITH:      module,id,site,opcode,ordinal,line,column,function,file
+; ARITH-NEXT: {{[0-9a-f]+}},0,{{[0-9a-f]+}},add,0,0,0,axpy,
+; ARITH-NOT:  ,store,
+
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @axpy(i32* %a, i32 %k, i32* %c, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [0, %entry], [%i.next, %loop]
+  %pa = getelementptr i32, i32* %a, i32 %i
+  %pc = getelementptr i32, i32* %c, i32 %i
+  %x = load i32, i32* %pa
+  %z = load i32, i32* %pc
+  %m = mul i32 %k, %z
+  %s = add i32 %x, %m
+  store i32 %s, i32* %pa
+  %i.next = add i32 %i, 1
+  %cnd = icmp slt i32 %i.next, %n
+  br i1 %cnd, label %loop, label %exit
+exit:
+  ret void
+}
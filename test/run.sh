@@ -0,0 +1,23 @@
+#!/bin/bash
+# Runs the RUN: lines of @test one by one, as lit would, in a scratch
+# directory. CMakeLists.txt gives the tools in the environment:
+#   %s -> the test, %t -> a path in the scratch directory, %opt, %FileCheck,
+#   %dag, %countstores, %countarith (opt arguments that run the pass),
+#   %profdata, %driver, %llc, %cc and %collect (links a program with the
+#   Collect runtime)
+test=$1
+tmp=$2
+
+rm -rf "$tmp"
+mkdir -p "$tmp"
+cd "$tmp" || exit 1
+
+grep -o 'RUN: .*' "$test" | sed 's/^RUN: //' | while IFS= read -r line; do
+  cmd=$(printf '%s\n' "$line" | sed -e "s|%countstores|$STORES|g" -e "s|%countarith|$ARITH|g" \
+    -e "s|%s|$test|g" -e "s|%t|$tmp/t|g" \
+    -e "s|%opt|$OPT|g" -e "s|%FileCheck|$FILECHECK|g" -e "s|%dag|$DAG|g" \
+    -e "s|%profdata|$PROFDATA|g" -e "s|%driver|$DRIVER|g" -e "s|%llc|$LLC|g" \
+    -e "s|%collect|$COLLECT -lm -lpthread|g" -e "s|%cc|$CC|g")
+  echo "$cmd"
+  bash -o pipefail -c "$cmd" || exit 1
+done